@@ -66,10 +66,16 @@ void GameApplication::run()
 	//	owningWorld->physicsScene->Tick(delta);
 	//	});
 
+	buildFrameGraph();
+
+	System::FProfiler::Get().SetThreadName("MainThread");
+
 	//todo:  exit condition could be more complex.
 	while (!m_mainWindow->shouldClose()) {
 		//std::cout << "tick main loop" << '\n';
 
+		//frame limiter / low latency delay, no-op with the default pacing
+		gTime->WaitForNextFrame();
 		gTime->BeginFrame();
 
 		auto& timeInfo = gTime->GetTimeInfo();
@@ -82,7 +88,9 @@ void GameApplication::run()
 			+ std::format(" eDelta: {:.4f}", timeInfo.engineDelta)
 			+ std::format(" eFPS: {:.2f}", FPS)
 			+ std::format(" eTime: {:.4f}", timeInfo.engineTime)
-			+ std::format(" simTime: {:.4f}", timeInfo.simTime);
+			+ std::format(" simTime: {:.4f}", timeInfo.simTime)
+			+ std::format(" simLoad: {:.2f} L{}", gTime->GetOverloadMetrics().load, (int)gTime->GetOverloadMetrics().level)
+			+ std::format(" latency: {:.1f}ms", gTime->GetFramePacingMetrics().inputToPresentMs);
 		m_mainWindow->SetCustomWindowText(text);
 #endif
 
@@ -110,46 +118,109 @@ void GameApplication::run()
 		//m_renderer->OnRender();
 
 
-		m_taskSystem.AddTask(
-			"main",
-			[=]() {
-				m_mainWindow->onUpdate(); 
-				m_inputSystem->OnUpdate(); 
-				m_uiManager->RouteEvents(); 
-				m_uiManager->Tick(delta); 
-				m_world->OnTick(delta); 
-				m_world->SyncGameToPhysics();
-			},
-			System::ETaskDomain::MainThread,
-			{}
-		); 
-
-		m_taskSystem.AddTask(
-			"physics",
-			[=]() { 
-				gTime->PumpFixedSteps();
-			},
-			System::ETaskDomain::PhysicsThread,
-			{}
-		);
-
-		m_taskSystem.AddTask(
-		"renderThread",
-		[=]() {  
+		m_taskSystem.Run(m_frameGraph);
+
+		handoffFrame();
+
+		//a level switch frees what the proxies of this frame and the ones in flight point to,
+		//so it waits until they are all rendered
+		if (!m_world->levelToLoad.empty()) {
+			flushRenderFrames();
+		}
+
+		m_world->EndFrame();
+
+	}//while
+
+	flushRenderFrames();
+
+	m_world->EndPlay();
+}
+
+void GameApplication::SetFrameLatency(uint32_t latency)
+{
+	m_frameLatency = std::min<uint32_t>(latency, RenderCommandBuffer::MaxFrameLatency);
+}
+
+void GameApplication::handoffFrame()
+{
+	PROFILE_SCOPE("Application::HandoffFrame");
+	auto& timeInfo = gTime->GetTimeInfo();
+	float delta = (float)timeInfo.engineDelta;
+
+	//close this frame's render commands, the render thread only sees the snapshot
+	m_renderer->SubmitFrameTime((float)timeInfo.engineTime);
+	m_renderer->EndGameFrame();
+
+	auto& fence = m_renderFences[m_frameNumber % m_renderFences.size()];
+	assert(fence.IsDone());
+	fence.Reset(1);
+
+	m_taskSystem.Enqueue(
+		System::ETaskDomain::RenderThread,
+		[this, delta, frame = m_frameNumber]() {
 			m_renderer->OnUpdate(delta);
 			m_renderer->OnRender();
+			gTime->MarkPresented(frame, m_renderer->GetLastPresentWait());
 		},
-		System::ETaskDomain::RenderThread,
+		&fence
+	);
+
+	//bound the frames in flight: simulation of the next frame overlaps at most m_frameLatency renders
+	if (m_frameNumber >= m_frameLatency) {
+		auto& oldest = m_renderFences[(m_frameNumber - m_frameLatency) % m_renderFences.size()];
+		System::FJobSystem::Get().Wait(oldest);
+	}
+
+	++m_frameNumber;
+}
+
+void GameApplication::flushRenderFrames()
+{
+	for (auto& fence : m_renderFences) {
+		System::FJobSystem::Get().Wait(fence);
+	}
+}
+
+void GameApplication::buildFrameGraph()
+{
+	//built once; per-frame values are read inside the callbacks
+	m_frameGraph.AddTask(
+		"main",
+		[this]() {
+			float delta = (float)gTime->GetTimeInfo().engineDelta;
+			m_mainWindow->onUpdate(); 
+			m_inputSystem->OnUpdate(); 
+			gTime->MarkInputSampled(m_frameNumber);
+
+			//on-demand capture of the last few seconds of zones
+			if (m_inputSystem->IsKeyJustPressed(KeyCode::F9)) {
+				System::FProfiler::Get().DumpChromeTrace(GetAssetFullPath("trace.json"));
+			}
+
+			m_uiManager->RouteEvents(); 
+			m_uiManager->Tick(delta); 
+			m_world->OnTick(delta); 
+			m_world->SyncGameToPhysics();
+		},
+		System::ETaskDomain::MainThread,
 		{}
-		);
+	); 
 
-		m_taskSystem.ExecuteAll();
-		 
-		m_world->EndFrame();
+	m_frameGraph.AddTask(
+		"physics",
+		[this]() { 
+			gTime->PumpFixedSteps();
+		},
+		System::ETaskDomain::PhysicsThread,
+		{}
+	);
 
-	}//while
+	//render is not part of the graph, it is launched at the frame handoff, see handoffFrame
 
-	m_world->EndPlay();
+	if (!m_frameGraph.Compile()) {
+		throw std::runtime_error("Failed to compile frame task graph");
+	}
 }
 
 void GameApplication::onBeginGame()
@@ -16,6 +16,7 @@
 #include "UI.h"
 
 #include "Core/Task.h" 
+#include "Core/Profiler.h"
 
 #include "Gameplay/Level.h"
 #include "Gameplay/World.h"
@@ -106,6 +107,13 @@ private:
 	[[nodiscard]] bool initWorkingDirectory();
 	[[nodiscard]] bool initWindow();
 
+	void buildFrameGraph();
+
+	//close the game frame and launch its render on the render thread
+	void handoffFrame();
+	//wait until the render thread has finished every launched frame
+	void flushRenderFrames();
+
 protected:
 	//std::vector<SharedPtr<LayerBase>> m_layers;  //add,remove,clear..
 	//hardocde for simplicity.  todo:
@@ -143,4 +151,14 @@ private:
 public:
 	UniquePtr<System::TimeSystem> gTime = CreateUnique<System::TimeSystem>();
 	System::FTaskSystem m_taskSystem{};
+	System::FTaskGraph m_frameGraph{};
+
+	//0: render waits for this frame's simulation; N: simulation runs up to N frames ahead of the render thread
+	void SetFrameLatency(uint32_t latency);
+	uint32_t GetFrameLatency() const { return m_frameLatency; }
+
+private:
+	uint32_t m_frameLatency = 1;
+	uint64_t m_frameNumber = 0;
+	std::array<System::FCounter, RenderCommandBuffer::NumBuffers> m_renderFences;
 };
\ No newline at end of file
@@ -0,0 +1,384 @@
+// Work-Stealing Job System
+// Goals:
+// - one Chase-Lev deque per worker, owner pushes/pops at the bottom, thieves steal from the top
+// - worker count sized to the hardware, minus the threads the engine already owns
+// - a ParallelFor primitive shared by physics, culling, animation
+// - FCounter completion handles: waiters help run jobs, then sleep on the atomic instead of spinning
+// - thread-affine work (physics/render domains) stays in FTaskSystem, see Task.h
+
+#pragma once
+#include <functional>
+#include <vector>
+#include <memory>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+#include <string>
+
+#include "Profiler.h"
+
+namespace System {
+
+    class FJobSystem;
+
+    /*
+    * completion handle, counts outstanding work.
+    * the decrement that reaches zero wakes every waiter through std::atomic::notify_all,
+    * which maps to WaitOnAddress / futex, so a blocked waiter costs no CPU.
+    * a counter only reads as done once that decrement is finished with it,
+    * so a waiter may destroy a stack counter as soon as Wait returns.
+    */
+    class FCounter {
+    public:
+        FCounter() : value(0), bReleased(true) {}
+        explicit FCounter(int initial) : value(initial), bReleased(initial <= 0) {}
+
+        FCounter(const FCounter&) = delete;
+        FCounter& operator=(const FCounter&) = delete;
+
+        //not while work is in flight
+        void Reset(int count) {
+            value.store(count, std::memory_order_relaxed);
+            bReleased.store(count <= 0, std::memory_order_relaxed);
+        }
+        //before the work it counts is submitted
+        void Add(int count) {
+            if (count > 0) bReleased.store(false, std::memory_order_relaxed);
+            value.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        //returns true for the decrement that completed the counter
+        bool Decrement() {
+            if (value.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                value.notify_all();
+                //last touch: from here a waiter may return and destroy the counter
+                bReleased.store(true, std::memory_order_release);
+                return true;
+            }
+            return false;
+        }
+
+        bool IsDone() const { return bReleased.load(std::memory_order_acquire); }
+        int Get() const { return value.load(std::memory_order_acquire); }
+
+        //block without helping, for threads that must not pick up pool jobs
+        void Wait() const {
+            int current = value.load(std::memory_order_acquire);
+            while (current > 0) {
+                value.wait(current, std::memory_order_acquire);
+                current = value.load(std::memory_order_acquire);
+            }
+            //the final decrement is between its notify and its release, a few instructions
+            while (!IsDone()) std::this_thread::yield();
+        }
+
+    private:
+        friend class FJobSystem;
+        std::atomic<int> value;
+        std::atomic<bool> bReleased;
+    };
+
+    struct FJob {
+        std::function<void()> callback;
+        FCounter* counter{ nullptr }; //optional, decremented after the callback
+    };
+
+    /*
+    * Chase-Lev deque (Le et al. 2013, "Correct and Efficient Work-Stealing for Weak Memory Models").
+    * fixed capacity ring; Push reports failure instead of growing,
+    * the caller falls back to the shared injection queue, so no buffer reclamation is needed.
+    */
+    template<typename T, uint32_t Capacity = 4096>
+    class TWorkStealingDeque {
+        static_assert((Capacity& (Capacity - 1)) == 0, "capacity must be a power of two");
+        static constexpr int64_t Mask = Capacity - 1;
+
+    public:
+        //owner only
+        bool Push(T item) {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            if (b - t >= (int64_t)Capacity) return false;
+
+            buffer[b & Mask].store(item, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        //owner only
+        T Pop() {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                //empty
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return T{};
+            }
+
+            T item = buffer[b & Mask].load(std::memory_order_relaxed);
+            if (t == b) {
+                //last item, race against thieves
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = T{};
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        //any thread
+        T Steal() {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+
+            if (t >= b) return T{};
+
+            T item = buffer[t & Mask].load(std::memory_order_relaxed);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return T{};
+            return item;
+        }
+
+        bool Empty() const {
+            return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+        }
+
+    private:
+        alignas(64) std::atomic<int64_t> top{ 0 };
+        alignas(64) std::atomic<int64_t> bottom{ 0 };
+        std::atomic<T> buffer[Capacity]{};
+    };
+
+
+    class FJobSystem {
+    public:
+        //engine-wide pool
+        static FJobSystem& Get() {
+            static FJobSystem instance;
+            return instance;
+        }
+
+        //main + physics + render are already dedicated threads
+        static uint32_t DefaultWorkerCount(uint32_t reservedThreads = 3) {
+            uint32_t hw = std::thread::hardware_concurrency();
+            if (hw == 0) hw = 4;
+            return std::max(1u, hw > reservedThreads ? hw - reservedThreads : 1u);
+        }
+
+        explicit FJobSystem(uint32_t numWorkers = DefaultWorkerCount()) {
+            m_deques.reserve(numWorkers);
+            for (uint32_t i = 0; i < numWorkers; ++i)
+                m_deques.push_back(std::make_unique<TWorkStealingDeque<FJob*>>());
+
+            m_workers.reserve(numWorkers);
+            for (uint32_t i = 0; i < numWorkers; ++i)
+                m_workers.emplace_back([this, i] { WorkerLoop(i); });
+        }
+
+        ~FJobSystem() {
+            {
+                std::lock_guard<std::mutex> lock(m_sleepMutex);
+                bExit = true;
+            }
+            m_sleepCV.notify_all();
+            for (auto& t : m_workers) if (t.joinable()) t.join();
+
+            //drop anything left behind
+            while (FJob* job = PopInjected()) delete job;
+            for (auto& dq : m_deques)
+                while (FJob* job = dq->Steal()) delete job;
+        }
+
+        FJobSystem(const FJobSystem&) = delete;
+        FJobSystem& operator=(const FJobSystem&) = delete;
+
+        uint32_t GetWorkerCount() const { return (uint32_t)m_workers.size(); }
+
+        void Submit(std::function<void()> callback, FCounter* counter = nullptr) {
+            FJob* job = new FJob{ std::move(callback), counter };
+
+            m_queuedJobs.fetch_add(1, std::memory_order_seq_cst);
+
+            //workers push to their own deque, external threads go through the injection queue
+            bool bPushed = false;
+            if (tl_owner == this && tl_workerIndex >= 0) {
+                bPushed = m_deques[tl_workerIndex]->Push(job);
+            }
+            if (!bPushed) {
+                std::lock_guard<std::mutex> lock(m_injectMutex);
+                m_injected.push(job);
+            }
+
+            WakeOne();
+        }
+
+        /*
+        * split [0, count) into chunks of at least grainSize, fn(begin, end) per chunk.
+        * the calling thread runs a chunk itself and helps until all chunks are done.
+        */
+        void ParallelFor(uint32_t count, uint32_t grainSize,
+            const std::function<void(uint32_t begin, uint32_t end)>& fn)
+        {
+            if (count == 0) return;
+            grainSize = std::max(1u, grainSize);
+
+            //no point in splitting finer than the pool can consume
+            const uint32_t maxChunks = (GetWorkerCount() + 1) * 4;
+            uint32_t numChunks = (count + grainSize - 1) / grainSize;
+            numChunks = std::min(numChunks, maxChunks);
+
+            if (numChunks <= 1) {
+                fn(0, count);
+                return;
+            }
+
+            const uint32_t chunkSize = (count + numChunks - 1) / numChunks;
+            numChunks = (count + chunkSize - 1) / chunkSize;
+
+            FCounter counter{ (int)numChunks - 1 };
+            for (uint32_t c = 1; c < numChunks; ++c) {
+                uint32_t begin = c * chunkSize;
+                uint32_t end = std::min(count, begin + chunkSize);
+                Submit([&fn, begin, end] { fn(begin, end); }, &counter);
+            }
+
+            fn(0, std::min(count, chunkSize));
+            Wait(counter);
+        }
+
+        /*
+        * help run queued jobs until the counter drains;
+        * once there is nothing left to steal, spin briefly and then sleep on the counter.
+        */
+        void Wait(const FCounter& counter) {
+            if (counter.IsDone()) return;
+            PROFILE_SCOPE("JobSystem::Wait");
+
+            int idleSpins = 0;
+            while (!counter.IsDone()) {
+                if (TryExecuteOne()) {
+                    idleSpins = 0;
+                    continue;
+                }
+                if (++idleSpins < kIdleSpinCount) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                //the remaining work is in flight on other threads
+                int current = counter.Get();
+                if (current > 0) counter.value.wait(current, std::memory_order_acquire);
+                idleSpins = 0;
+            }
+        }
+
+        //run one queued job on the calling thread, if any
+        bool TryExecuteOne() {
+            int self = (tl_owner == this) ? tl_workerIndex : -1;
+            FJob* job = FindJob(self);
+            if (!job) return false;
+            Run(job);
+            return true;
+        }
+
+    private:
+        void WorkerLoop(uint32_t index) {
+            tl_owner = this;
+            tl_workerIndex = (int)index;
+            FProfiler::Get().SetThreadName("Worker " + std::to_string(index));
+
+            while (true) {
+                if (FJob* job = FindJob((int)index)) {
+                    Run(job);
+                    continue;
+                }
+
+                std::unique_lock lock(m_sleepMutex);
+                m_numSleeping.fetch_add(1, std::memory_order_seq_cst);
+                m_sleepCV.wait(lock, [&] {
+                    return bExit || m_queuedJobs.load(std::memory_order_seq_cst) > 0;
+                    });
+                m_numSleeping.fetch_sub(1, std::memory_order_relaxed);
+                if (bExit) break;
+            }
+        }
+
+        FJob* FindJob(int self) {
+            FJob* job = nullptr;
+
+            if (self >= 0) job = m_deques[self]->Pop();
+            if (!job) job = PopInjected();
+
+            if (!job) {
+                //steal, starting from a neighbour so thieves spread out
+                const uint32_t n = (uint32_t)m_deques.size();
+                const uint32_t start = (uint32_t)(self + 1);
+                for (uint32_t i = 0; i < n && !job; ++i) {
+                    uint32_t victim = (start + i) % n;
+                    if ((int)victim == self) continue;
+                    job = m_deques[victim]->Steal();
+                }
+            }
+
+            if (job) m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+
+        FJob* PopInjected() {
+            std::lock_guard<std::mutex> lock(m_injectMutex);
+            if (m_injected.empty()) return nullptr;
+            FJob* job = m_injected.front();
+            m_injected.pop();
+            return job;
+        }
+
+        void Run(FJob* job) {
+            if (job->callback) job->callback();
+            if (job->counter) job->counter->Decrement();
+            delete job;
+        }
+
+        void WakeOne() {
+            //pairs with the seq_cst increment in WorkerLoop, a sleeper either sees the job or gets notified
+            if (m_numSleeping.load(std::memory_order_seq_cst) == 0) return;
+            { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+            m_sleepCV.notify_one();
+        }
+
+    private:
+        static constexpr int kIdleSpinCount = 16;
+
+        std::vector<std::unique_ptr<TWorkStealingDeque<FJob*>>> m_deques;
+        std::vector<std::thread> m_workers;
+
+        std::queue<FJob*> m_injected;
+        std::mutex m_injectMutex;
+
+        std::mutex m_sleepMutex;
+        std::condition_variable m_sleepCV;
+        std::atomic<int> m_numSleeping = 0;
+        std::atomic<int> m_queuedJobs = 0;
+        bool bExit = false;
+
+        static inline thread_local FJobSystem* tl_owner = nullptr;
+        static inline thread_local int tl_workerIndex = -1;
+    };
+
+}
+
+/*
+Usage:
+
+auto& jobs = System::FJobSystem::Get();
+jobs.ParallelFor((uint32_t)bodies.size(), 64, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i) Integrate(bodies[i]);
+});
+*/
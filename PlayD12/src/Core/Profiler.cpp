@@ -0,0 +1,117 @@
+#include "PCH.h"
+
+#include "Profiler.h"
+
+#include <fstream>
+#include <iomanip>
+
+
+namespace System {
+
+    void FThreadZoneBuffer::Snapshot(std::vector<FZoneRecord>& out) const
+    {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > Capacity ? end - Capacity : 0;
+
+        for (uint64_t i = begin; i < end; ++i) {
+            const FZoneSlot& slot = slots[i & Mask];
+            if (slot.seq.load(std::memory_order_acquire) != i) continue;
+
+            FZoneRecord record;
+            record.name = slot.name.load(std::memory_order_relaxed);
+            record.beginNs = slot.beginNs.load(std::memory_order_relaxed);
+            record.endNs = slot.endNs.load(std::memory_order_relaxed);
+
+            //the owner started on a newer zone while we copied, the fields may be mixed
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != i) continue;
+
+            out.push_back(record);
+        }
+    }
+
+
+    void FProfiler::SetThreadName(const std::string& name)
+    {
+        auto& buffer = GetThreadBuffer();
+        std::lock_guard<std::mutex> lock(m_registryMutex);
+        buffer.threadName = name;
+    }
+
+    const char* FProfiler::InternName(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_registryMutex);
+        for (auto& interned : m_internedNames) {
+            if (*interned == name) return interned->c_str();
+        }
+        m_internedNames.push_back(std::make_unique<std::string>(name));
+        return m_internedNames.back()->c_str();
+    }
+
+    FThreadZoneBuffer* FProfiler::RegisterThread()
+    {
+        std::lock_guard<std::mutex> lock(m_registryMutex);
+        auto buffer = std::make_unique<FThreadZoneBuffer>();
+        buffer->threadId = (uint32_t)m_buffers.size();
+        buffer->threadName = "Thread " + std::to_string(buffer->threadId);
+        m_buffers.push_back(std::move(buffer));
+        return m_buffers.back().get();
+    }
+
+    bool FProfiler::DumpChromeTrace(const std::string& path)
+    {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "[Profiler] failed to open trace file: " << path << '\n';
+            return false;
+        }
+
+        //names are code identifiers or task names, escaping quotes and backslashes is enough
+        auto writeEscaped = [&](const char* text) {
+            for (const char* c = text; *c; ++c) {
+                if (*c == '"' || *c == '\\') file << '\\';
+                file << *c;
+            }
+            };
+
+        std::vector<FZoneRecord> zones;
+        size_t eventCount = 0;
+
+        file << std::fixed << std::setprecision(3);
+        file << "{\"traceEvents\":[\n";
+        bool bFirst = true;
+
+        std::lock_guard<std::mutex> lock(m_registryMutex);
+        for (auto& buffer : m_buffers) {
+            if (!bFirst) file << ",\n";
+            bFirst = false;
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->threadId
+                << ",\"args\":{\"name\":\"";
+            writeEscaped(buffer->threadName.c_str());
+            file << "\"}}";
+
+            zones.clear();
+            buffer->Snapshot(zones);
+            for (auto& zone : zones) {
+                if (zone.beginNs < m_originNs) continue;
+
+                //chrome expects microseconds
+                double ts = (zone.beginNs - m_originNs) / 1000.0;
+                double dur = (zone.endNs - zone.beginNs) / 1000.0;
+
+                file << ",\n{\"name\":\"";
+                writeEscaped(zone.name);
+                file << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadId
+                    << ",\"ts\":" << ts
+                    << ",\"dur\":" << dur << "}";
+                ++eventCount;
+            }
+        }
+
+        file << "\n]}\n";
+
+        std::cout << "[Profiler] wrote " << eventCount << " zones to " << path << '\n';
+        return true;
+    }
+
+}
@@ -0,0 +1,164 @@
+// Scoped Zone Profiler
+// Goals:
+// - cheap enough to stay on in release: two clock reads and one ring write per zone, no locks
+// - one ring buffer per thread, written only by its owner, oldest zones are overwritten
+// - dump on demand as Chrome trace json (chrome://tracing, ui.perfetto.dev)
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//compile-time switch, zones compile to nothing when 0
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 1
+#endif
+
+namespace System {
+
+    struct FZoneRecord {
+        const char* name;  //must outlive the profiler, literal or FProfiler::InternName
+        uint64_t beginNs;
+        uint64_t endNs;
+    };
+
+    /*
+    * single producer: the owning thread; the dumper only reads.
+    * every slot is a small seqlock: seq holds the index of the zone in it, Busy while the owner rewrites it,
+    * so a reader keeps a slot only if seq was that index both before and after copying the fields.
+    */
+    class FThreadZoneBuffer {
+    public:
+        static constexpr uint32_t Capacity = 1u << 15;
+        static constexpr uint64_t Mask = Capacity - 1;
+        static constexpr uint64_t Busy = UINT64_MAX;
+
+        void Push(const FZoneRecord& record) {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            FZoneSlot& slot = slots[h & Mask];
+
+            slot.seq.store(Busy, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.name.store(record.name, std::memory_order_relaxed);
+            slot.beginNs.store(record.beginNs, std::memory_order_relaxed);
+            slot.endNs.store(record.endNs, std::memory_order_relaxed);
+            slot.seq.store(h, std::memory_order_release);
+
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        //copies the zones still in the ring; those overwritten during the copy are dropped
+        void Snapshot(std::vector<FZoneRecord>& out) const;
+
+        uint32_t threadId = 0;
+        std::string threadName;
+
+    private:
+        struct FZoneSlot {
+            std::atomic<uint64_t> seq{ Busy };
+            std::atomic<const char*> name{ nullptr };
+            std::atomic<uint64_t> beginNs{ 0 };
+            std::atomic<uint64_t> endNs{ 0 };
+        };
+
+        std::atomic<uint64_t> head{ 0 };
+        FZoneSlot slots[Capacity];
+    };
+
+
+    class FProfiler {
+    public:
+        static FProfiler& Get() {
+            static FProfiler instance;
+            return instance;
+        }
+
+        static uint64_t NowNs() {
+            using namespace std::chrono;
+            return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+        }
+
+        void SetEnabled(bool enabled) { bEnabled.store(enabled, std::memory_order_relaxed); }
+        bool IsEnabled() const { return bEnabled.load(std::memory_order_relaxed); }
+
+        //label the calling thread in the trace
+        void SetThreadName(const std::string& name);
+
+        //stable storage for names that are not literals, eg. task names
+        const char* InternName(const std::string& name);
+
+        void Record(const char* name, uint64_t beginNs, uint64_t endNs) {
+            GetThreadBuffer().Push(FZoneRecord{ name, beginNs, endNs });
+        }
+
+        //write every thread's ring as Chrome trace events
+        bool DumpChromeTrace(const std::string& path);
+
+    private:
+        FProfiler() = default;
+
+        FThreadZoneBuffer& GetThreadBuffer() {
+            thread_local FThreadZoneBuffer* tl_buffer = nullptr;
+            if (!tl_buffer) tl_buffer = RegisterThread();
+            return *tl_buffer;
+        }
+
+        FThreadZoneBuffer* RegisterThread();
+
+    private:
+        std::atomic<bool> bEnabled{ true };
+
+        //buffers are kept after their thread exits, so late dumps still see them
+        std::mutex m_registryMutex;
+        std::vector<std::unique_ptr<FThreadZoneBuffer>> m_buffers;
+        std::vector<std::unique_ptr<std::string>> m_internedNames;
+
+        uint64_t m_originNs = NowNs();
+    };
+
+
+    class FScopedZone {
+    public:
+        explicit FScopedZone(const char* name) : name(name) {
+            if (FProfiler::Get().IsEnabled()) beginNs = FProfiler::NowNs();
+        }
+
+        ~FScopedZone() {
+            if (beginNs != 0) FProfiler::Get().Record(name, beginNs, FProfiler::NowNs());
+        }
+
+        FScopedZone(const FScopedZone&) = delete;
+        FScopedZone& operator=(const FScopedZone&) = delete;
+
+    private:
+        const char* name;
+        uint64_t beginNs = 0;
+    };
+
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if ENABLE_PROFILER
+#define PROFILE_SCOPE(name) ::System::FScopedZone PROFILE_CONCAT(_profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#endif
+
+/*
+Usage:
+
+void PhysicsScene::Tick(float delta) {
+    PROFILE_SCOPE("Physics::Tick");
+    ...
+}
+
+System::FProfiler::Get().DumpChromeTrace("trace.json");
+*/
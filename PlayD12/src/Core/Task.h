@@ -2,6 +2,8 @@
 // Goals:
 // - Domain-based thread workers , per-frame std::future construction
 // - thread-safe, reusable queue model
+// - FTaskGraph is built and compiled once, each frame only re-arms counters
+// - WorkerThread domain is served by the work-stealing FJobSystem, see JobSystem.h
 
 #pragma once
 #include <functional>
@@ -16,6 +18,9 @@
 #include <condition_variable>
 #include <atomic>
 
+#include "JobSystem.h"
+#include "Profiler.h"
+
 namespace System {
 
     enum class ETaskDomain {
@@ -36,13 +41,140 @@ namespace System {
         }
     }
 
-    struct FTask {
-        std::string debugName;
-        std::function<void()> callback;
-        std::vector<std::string> deps;
-        ETaskDomain domain = ETaskDomain::MainThread;
-        bool bExecuted = false;
-        std::mutex Mutex;
+    /*
+    * a frame graph is declared once by name, then compiled:
+    * - duplicate names, missing deps and cycles are rejected
+    * - nodes are topologically sorted, deps are resolved to integer successor lists
+    * at runtime only the per-node atomic counters are re-armed, see FTaskSystem::Run
+    */
+    class FTaskGraph {
+    public:
+        using TaskIndex = uint32_t;
+
+        void AddTask(const std::string& name,
+            std::function<void()> callback,
+            ETaskDomain domain = ETaskDomain::MainThread,
+            const std::vector<std::string>& deps = {})
+        {
+            assert(!bCompiled && "graph is already compiled");
+            nodes.push_back(FNode{ name, std::move(callback), domain, deps });
+        }
+
+        bool Compile() {
+            const uint32_t count = (uint32_t)nodes.size();
+
+            std::unordered_map<std::string, TaskIndex> nameToIndex;
+            nameToIndex.reserve(count);
+            for (TaskIndex i = 0; i < count; ++i) {
+                if (!nameToIndex.emplace(nodes[i].debugName, i).second) {
+                    std::cerr << "[TaskGraph] duplicate task name: " << nodes[i].debugName << '\n';
+                    return false;
+                }
+            }
+
+            //resolve names to indices
+            std::vector<std::vector<TaskIndex>> successors(count);
+            std::vector<int> inDegree(count, 0);
+            for (TaskIndex i = 0; i < count; ++i) {
+                for (const auto& dep : nodes[i].depNames) {
+                    auto it = nameToIndex.find(dep);
+                    if (it == nameToIndex.end()) {
+                        std::cerr << "[TaskGraph] task " << nodes[i].debugName << " depends on missing task: " << dep << '\n';
+                        return false;
+                    }
+                    successors[it->second].push_back(i);
+                    ++inDegree[i];
+                }
+            }
+
+            //Kahn's algorithm, stable with respect to declaration order
+            std::vector<TaskIndex> order;
+            order.reserve(count);
+            std::vector<int> remainingDeps = inDegree;
+            for (TaskIndex i = 0; i < count; ++i)
+                if (remainingDeps[i] == 0) order.push_back(i);
+            for (size_t head = 0; head < order.size(); ++head) {
+                for (TaskIndex s : successors[order[head]])
+                    if (--remainingDeps[s] == 0) order.push_back(s);
+            }
+
+            if (order.size() != count) {
+                std::cerr << "[TaskGraph] cycle detected among:";
+                for (TaskIndex i = 0; i < count; ++i)
+                    if (remainingDeps[i] > 0) std::cerr << ' ' << nodes[i].debugName;
+                std::cerr << '\n';
+                return false;
+            }
+
+            //re-lay nodes in topological order
+            std::vector<TaskIndex> oldToNew(count);
+            for (TaskIndex n = 0; n < count; ++n) oldToNew[order[n]] = n;
+
+            std::vector<FNode> sorted;
+            sorted.reserve(count);
+            for (TaskIndex n = 0; n < count; ++n) {
+                TaskIndex old = order[n];
+                FNode node = std::move(nodes[old]);
+                node.numDeps = inDegree[old];
+                node.successors.clear();
+                for (TaskIndex s : successors[old]) node.successors.push_back(oldToNew[s]);
+                node.depNames.clear();
+                node.depNames.shrink_to_fit();
+                node.profileName = FProfiler::Get().InternName(node.debugName);
+                sorted.push_back(std::move(node));
+            }
+            nodes = std::move(sorted);
+
+            roots.clear();
+            mainThreadOrder.clear();
+            numAsyncTasks = 0;
+            for (TaskIndex n = 0; n < count; ++n) {
+                if (nodes[n].numDeps == 0) roots.push_back(n);
+                if (nodes[n].domain == ETaskDomain::MainThread) mainThreadOrder.push_back(n);
+                else ++numAsyncTasks;
+            }
+
+            remaining = std::make_unique<FCounter[]>(count);
+            bCompiled = true;
+            return true;
+        }
+
+        bool IsCompiled() const { return bCompiled; }
+        uint32_t GetTaskCount() const { return (uint32_t)nodes.size(); }
+
+        void DebugPrint() const {
+            std::cout << "[TaskGraph] " << (bCompiled ? "compiled" : "not compiled") << ", tasks:\n";
+            for (TaskIndex i = 0; i < nodes.size(); ++i) {
+                const auto& node = nodes[i];
+                std::cout << " - " << i << " " << node.debugName << " [" << DomainName(node.domain) << "] (successors: ";
+                for (TaskIndex s : node.successors) std::cout << s << " ";
+                std::cout << ")\n";
+            }
+        }
+
+    private:
+        friend class FTaskSystem;
+
+        struct FNode {
+            std::string debugName;
+            std::function<void()> callback;
+            ETaskDomain domain = ETaskDomain::MainThread;
+            std::vector<std::string> depNames; //build-time only
+            const char* profileName = "Task";   //interned debugName
+
+            std::vector<TaskIndex> successors;
+            int numDeps = 0;
+        };
+
+        std::vector<FNode> nodes;
+        std::vector<TaskIndex> roots;
+        std::vector<TaskIndex> mainThreadOrder;
+        int numAsyncTasks = 0;
+
+        //per-frame state, one completion counter per node
+        std::unique_ptr<FCounter[]> remaining;
+
+        bool bCompiled = false;
     };
 
     class FTaskQueue {
@@ -91,7 +223,7 @@ namespace System {
         FTaskSystem() {
             StartWorker(ETaskDomain::PhysicsThread);
             StartWorker(ETaskDomain::RenderThread);
-            //StartWorker(ETaskDomain::WorkerThread);
+            //WorkerThread has no dedicated thread, it goes to the shared job pool
         }
 
         ~FTaskSystem() {
@@ -100,83 +232,138 @@ namespace System {
         }
 
         void StartWorker(ETaskDomain domain) {
-            threads[domain] = std::thread([this, domain] {
-                queues[domain].WorkerLoop();
+            //insert before the thread starts, the map itself is not thread-safe
+            FTaskQueue& queue = queues[domain];
+            threads[domain] = std::thread([&queue, domain] {
+                FProfiler::Get().SetThreadName(DomainName(domain));
+                queue.WorkerLoop();
                 });
         }
 
+        //launch a compiled graph and block until every task has run
+        void Run(FTaskGraph& graph) {
+            assert(graph.IsCompiled() && "compile the graph before running it");
+            PROFILE_SCOPE("TaskSystem::Run");
+
+            const uint32_t count = graph.GetTaskCount();
+            for (uint32_t i = 0; i < count; ++i)
+                graph.remaining[i].Reset(graph.nodes[i].numDeps);
+
+            pendingAsyncTasks.Add(graph.numAsyncTasks);
+
+            for (auto root : graph.roots) {
+                if (graph.nodes[root].domain != ETaskDomain::MainThread)
+                    Dispatch(graph, root);
+            }
+
+            //main-thread tasks run here in topological order, so waiting on one never blocks a dependency
+            for (auto index : graph.mainThreadOrder) {
+                FJobSystem::Get().Wait(graph.remaining[index]);
+                RunNode(graph, index);
+            }
+
+            WaitForAll();
+        }
+
+        //fire-and-forget onto a domain, completion is signalled through the optional counter
+        void Enqueue(ETaskDomain domain, std::function<void()> callback, FCounter* counter = nullptr) {
+            if (domain == ETaskDomain::WorkerThread) {
+                FJobSystem::Get().Submit(std::move(callback), counter);
+                return;
+            }
+
+            auto job = [callback = std::move(callback), counter] {
+                callback();
+                if (counter) counter->Decrement();
+                };
+
+            if (domain == ETaskDomain::MainThread) {
+                job();
+            }
+            else {
+                queues.at(domain).Push(std::move(job));
+            }
+        }
+
+        //one-shot convenience, builds a transient graph; prefer a prebuilt FTaskGraph per frame
         void AddTask(const std::string& name, 
             std::function<void()> callback,  
 			ETaskDomain domain = ETaskDomain::MainThread,
             const std::vector<std::string>& deps = {} ) 
         {
             std::lock_guard<std::mutex> lock(taskMutex);
-            assert(!tasks.contains(name) && "Duplicate task name");
-            tasks[name] = std::make_unique<FTask>(name, std::move(callback), deps, domain);
+            transientGraph.AddTask(name, std::move(callback), domain, deps);
         }
 
         void ExecuteAll() {
-            for (const auto& [name, task] : tasks) {
-                if (task->domain == ETaskDomain::MainThread) {
-					ExecuteTask(task.get());  
-                }
-
-                else {
-                    //queues[task->domain].Push([this, name] { ExecuteTask(name); });
-                    pendingAsyncTasks++; //increment immediately;
-                    queues[task->domain].Push([this, task = task.get()] {
-                        ExecuteTask(task);
-                        pendingAsyncTasks--;  
-                        });
-                }
+            FTaskGraph graph;
+            {
+                std::lock_guard<std::mutex> lock(taskMutex);
+                graph = std::move(transientGraph);
+                transientGraph = FTaskGraph{};
             }
-            WaitForAll();
-            Reset();
-            tasks.clear();  //a direct way 
+            if (!graph.Compile()) {
+                assert(false && "invalid task graph");
+                return;
+            }
+            Run(graph);
         }
 
         void DebugPrint() const {
-            std::cout << "[TaskSystem] Registered Tasks:\n";
-            for (const auto& [name, task] : tasks) {
-                std::cout << " - " << name << " [" << DomainName(task->domain) << "] (depends on: ";
-                for (const auto& dep : task->deps) std::cout << dep << " ";
-                std::cout << ")\n";
-            }
+            transientGraph.DebugPrint();
         }
 
     private: 
-        void ExecuteTask(FTask* task) {
-            std::lock_guard<std::mutex> lock(task->Mutex);
-            if (task->bExecuted) return;
-
-            for (const auto& dep : task->deps) {
-                ExecuteTask(tasks.at(dep).get());  
+        void RunNode(FTaskGraph& graph, FTaskGraph::TaskIndex index) {
+            auto& node = graph.nodes[index];
+            if (node.callback) {
+                PROFILE_SCOPE(node.profileName);
+                node.callback();
             }
 
-            if (task->callback) {
-                task->callback();
+            for (auto s : node.successors) {
+                if (graph.remaining[s].Decrement()
+                    && graph.nodes[s].domain != ETaskDomain::MainThread) {
+                    Dispatch(graph, s);
+                }
             }
-
-            task->bExecuted = true;
         }
 
-        void Reset() {
-            for (auto& [_, task] : tasks) task->bExecuted = false;
+        void Dispatch(FTaskGraph& graph, FTaskGraph::TaskIndex index) {
+            auto job = [this, &graph, index] {
+                RunNode(graph, index);
+                pendingAsyncTasks.Decrement();
+                };
+
+            ETaskDomain domain = graph.nodes[index].domain;
+            if (domain == ETaskDomain::WorkerThread) {
+                FJobSystem::Get().Submit(std::move(job));
+            }
+            else {
+                queues.at(domain).Push(std::move(job));
+            }
         }
 
         void WaitForAll() {
-            while (pendingAsyncTasks.load() > 0) {
-                std::this_thread::yield();
-            }
+            //help the pool, eg. parallel-for chunks spawned by physics, then sleep until the domains finish
+            PROFILE_SCOPE("TaskSystem::WaitForAll");
+            FJobSystem::Get().Wait(pendingAsyncTasks);
         }  
 
+    public:
+        //data-parallel helper shared by physics, culling, animation
+        void ParallelFor(uint32_t count, uint32_t grainSize,
+            const std::function<void(uint32_t begin, uint32_t end)>& fn) {
+            FJobSystem::Get().ParallelFor(count, grainSize, fn);
+        }
+
     private:
-        std::unordered_map<std::string, std::unique_ptr<FTask>> tasks;
+        FTaskGraph transientGraph;
         std::mutex taskMutex;
 
         std::unordered_map<ETaskDomain, FTaskQueue> queues;
         std::unordered_map<ETaskDomain, std::thread> threads;
-        std::atomic<int> pendingAsyncTasks = 0;
+        FCounter pendingAsyncTasks{ 0 };
 
     };
 
@@ -185,9 +372,12 @@ namespace System {
 /*
 Usage:
 
+FTaskGraph frame;
+frame.AddTask("GameLogic", [] { RunGameplay(); }, ETaskDomain::MainThread);
+frame.AddTask("Physics", [] { RunPhysics(); }, ETaskDomain::PhysicsThread, { "GameLogic" });
+frame.AddTask("Render", [] { SubmitFrame(); }, ETaskDomain::RenderThread);
+frame.Compile();
+
 FTaskSystem taskSys;
-taskSys.AddTask("GameLogic", [] { RunGameplay(); }, {}, ETaskDomain::MainThread);
-taskSys.AddTask("Physics", [] { RunPhysics(); }, {}, ETaskDomain::PhysicsThread);
-taskSys.AddTask("Render", [] { SubmitFrame(); }, {}, ETaskDomain::RenderThread);
-taskSys.ExecuteAll();
+while (running) taskSys.Run(frame);
 */
@@ -1,13 +1,20 @@
 #include "PCH.h"
 
 #include "Time.h"
+#include "Profiler.h"
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <thread>
 
 
 /*
 * intended for fixed update:
-* 
+* the base rate decides how many steps the frame owns (accumulator, catch-up cap),
+* then each tick runs every step whose time falls inside the frame's window.
+* a tick keeps its own clock (nextTime), so a 20Hz tick on a 60Hz base fires every third frame,
+* and amortized ticks of the same rate are phase-shifted to land on different frames.
 */
 
 namespace System {
@@ -16,6 +23,127 @@ namespace System {
 
     TimeSystem::TimeSystem() {
         m_lastRealTP = clock::now();
+        m_frameStartTP = m_lastRealTP;
+        ApplyOverloadLevel();
+
+#ifdef _WIN32
+        //high resolution timers wake within ~0.5ms instead of the 15.6ms scheduler tick
+        m_waitTimer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+#endif
+    }
+
+    TimeSystem::~TimeSystem() {
+#ifdef _WIN32
+        if (m_waitTimer) CloseHandle((HANDLE)m_waitTimer);
+#endif
+    }
+
+    void TimeSystem::SetFramePacing(const FramePacingPolicy& p) {
+        std::lock_guard<std::mutex> lock(m_pacingMutex);
+        m_pacing = p;
+    }
+
+    void TimeSystem::WaitForNextFrame() {
+        PROFILE_SCOPE("TimeSystem::WaitForNextFrame");
+
+        FramePacingPolicy pacing;
+        double delay = 0.0;
+        {
+            std::lock_guard<std::mutex> lock(m_pacingMutex);
+            pacing = m_pacing;
+
+            //present slack of the previous frames, minus a margin so a slow frame doesn't miss its vblank
+            if (pacing.bLowLatency) {
+                delay = std::max(0.0, m_pacingMetrics.presentWaitMs * 1e-3 - pacing.lowLatencyMargin);
+                if (pacing.targetFrameTime > 0.0) delay = std::min(delay, 0.5 * pacing.targetFrameTime);
+            }
+            m_pacingMetrics.lowLatencyDelayMs = delay * 1e3;
+        }
+
+        auto nowTP = clock::now();
+        auto wakeTP = nowTP;
+        if (pacing.targetFrameTime > 0.0) {
+            auto deadline = m_frameStartTP + duration_cast<clock::duration>(duration<double>(pacing.targetFrameTime));
+            //a frame that overran restarts the grid instead of rushing to catch up
+            wakeTP = std::max(deadline, nowTP);
+        }
+        wakeTP += duration_cast<clock::duration>(duration<double>(delay));
+
+        double sleptMs = 0.0, spunMs = 0.0;
+        SleepUntil(wakeTP, sleptMs, spunMs);
+
+        //the grid follows the limiter, not the low latency shift
+        m_frameStartTP = wakeTP - duration_cast<clock::duration>(duration<double>(delay));
+
+        std::lock_guard<std::mutex> lock(m_pacingMutex);
+        m_pacingMetrics.lastWaitMs = sleptMs + spunMs;
+        m_pacingMetrics.lastSpinMs = spunMs;
+    }
+
+    void TimeSystem::SleepUntil(clock::time_point tp, double& sleptMs, double& spunMs) {
+        auto beginTP = clock::now();
+        if (tp <= beginTP) return;
+
+        double spinWindow;
+        {
+            std::lock_guard<std::mutex> lock(m_pacingMutex);
+            spinWindow = m_pacing.spinWindow;
+        }
+
+        auto sleepEndTP = tp - duration_cast<clock::duration>(duration<double>(spinWindow));
+        if (sleepEndTP > beginTP) {
+            double seconds = duration<double>(sleepEndTP - beginTP).count();
+#ifdef _WIN32
+            if (m_waitTimer) {
+                LARGE_INTEGER due{};
+                due.QuadPart = -(LONGLONG)(seconds * 1e7); //relative, 100ns units
+                if (SetWaitableTimerEx((HANDLE)m_waitTimer, &due, 0, nullptr, nullptr, nullptr, 0))
+                    WaitForSingleObject((HANDLE)m_waitTimer, INFINITE);
+            }
+            else
+#endif
+            {
+                std::this_thread::sleep_for(duration<double>(seconds));
+            }
+        }
+
+        auto spinTP = clock::now();
+        while (clock::now() < tp) {
+            std::this_thread::yield();
+        }
+        auto endTP = clock::now();
+
+        sleptMs = duration<double, std::milli>(spinTP - beginTP).count();
+        spunMs = duration<double, std::milli>(endTP - spinTP).count();
+    }
+
+    void TimeSystem::MarkInputSampled(uint64_t frame) {
+        std::lock_guard<std::mutex> lock(m_pacingMutex);
+        m_inputTP[frame % kLatencySlots] = clock::now();
+    }
+
+    void TimeSystem::MarkPresented(uint64_t frame, double presentWaitSeconds) {
+        auto nowTP = clock::now();
+        constexpr double smoothing = 0.1;
+
+        std::lock_guard<std::mutex> lock(m_pacingMutex);
+        auto& m = m_pacingMetrics;
+
+        m.presentWaitMs += (presentWaitSeconds * 1e3 - m.presentWaitMs) * smoothing;
+
+        auto inputTP = m_inputTP[frame % kLatencySlots];
+        if (inputTP != clock::time_point{}) {
+            double latencyMs = duration<double, std::milli>(nowTP - inputTP).count();
+            m.lastInputToPresentMs = latencyMs;
+            m.maxInputToPresentMs = std::max(m.maxInputToPresentMs, latencyMs);
+            m.inputToPresentMs = m.presentedFrames == 0 ? latencyMs : m.inputToPresentMs + (latencyMs - m.inputToPresentMs) * smoothing;
+        }
+        ++m.presentedFrames;
+    }
+
+    FramePacingMetrics TimeSystem::GetFramePacingMetrics() const {
+        std::lock_guard<std::mutex> lock(m_pacingMutex);
+        return m_pacingMetrics;
     }
 
     void TimeSystem::BeginFrame() {
@@ -35,7 +163,7 @@ namespace System {
         m_info.engineDelta = engDt;
         m_info.engineTime += engDt;
 
-        double feed = (m_info.paused ? 0.0 : m_info.engineDelta);
+        double feed = (m_info.paused ? 0.0 : m_info.engineDelta * m_overload.dilation);
         m_accumulator += feed;
     }
 
@@ -47,76 +175,323 @@ namespace System {
     }
 
     void TimeSystem::PumpFixedSteps() {
-        //sortRegistriesIfNeeded();
+        const double fixedDt = m_effectiveFixedDt;
 
         int steps = 0;
+        double dropped = 0.0;
+        bool bStepping = m_pendingFixedSteps > 0;
         //resolve pending state
-        if (m_pendingFixedSteps > 0) {
+        if (bStepping) {
             steps = std::min(m_pendingFixedSteps, m_policy.maxCatchupSteps);
             m_pendingFixedSteps -= steps;
         }
         else
         {
-            while (m_accumulator + 1e-9 >= m_policy.fixedDt && steps < m_policy.maxCatchupSteps) {
-                m_accumulator -= m_policy.fixedDt;
+            while (m_accumulator + 1e-9 >= fixedDt && steps < m_overload.effectiveCatchupSteps) {
+                m_accumulator -= fixedDt;
                 ++steps;
             }
-        }
 
-        for (int i = 0; i < steps; ++i) {
-            for (auto& entry : m_fixedCB) {
-                // e.t->TickFixed(m_policy.fixedDt);
-                entry((float)m_policy.fixedDt);
+            //beyond the cap: keep at most one step of backlog, the rest is lost and reported
+            if (m_accumulator >= fixedDt) {
+                dropped = std::floor(m_accumulator / fixedDt) * fixedDt;
+                m_accumulator -= dropped;
             }
+        }
+
+        for (auto& entry : m_fixedTicks) {
+            entry.stats.stepsLastFrame = 0;
+            entry.stats.spentLastFrameMs = 0.0;
+        }
+
+        auto beginTP = clock::now();
+        if (steps > 0) {
+            RunFixedTicks(m_info.simTime + steps * fixedDt);
+        }
+        double pumpSeconds = duration<double>(clock::now() - beginTP).count();
+
+        //frame stepping in pause is not representative
+        if (!bStepping) UpdateOverload(pumpSeconds, steps, dropped);
 
-            //std::cout << "pump sim step" << '\n';
-            m_info.simTime += m_policy.fixedDt;
+        //apply registry changes made from inside callbacks
+        m_fixedTicks.erase(std::remove_if(m_fixedTicks.begin(), m_fixedTicks.end(),
+            [](const FixedTickEntry& e) { return e.bRemoved; }), m_fixedTicks.end());
+        for (auto& entry : m_addedTicks) {
+            if (!entry.bRemoved) m_fixedTicks.push_back(std::move(entry));
         }
+        m_addedTicks.clear();
     }
 
+    void TimeSystem::RunFixedTicks(double targetTime) {
+        constexpr double eps = 1e-9;
+        m_bTicking = true;
+
+        //a tick that fell behind (budget, rate) only catches up within the same window as the base rate
+        for (auto& entry : m_fixedTicks) {
+            double window = m_policy.maxCatchupSteps * entry.dt;
+            double behind = targetTime - window - entry.nextTime;
+            if (behind > eps) {
+                uint32_t dropped = (uint32_t)std::ceil(behind / entry.dt - eps);
+                entry.nextTime += dropped * entry.dt;
+                entry.stats.droppedSteps += dropped;
+            }
+        }
+
+        std::vector<bool> overBudget(m_fixedTicks.size(), false);
+
+        while (true) {
+            //earliest due step; same time -> explicit order -> registration order
+            int next = -1;
+            for (int i = 0; i < (int)m_fixedTicks.size(); ++i) {
+                const auto& e = m_fixedTicks[i];
+                if (e.bRemoved || overBudget[i]) continue;
+                if (e.nextTime > targetTime + eps) continue;
+                if (next < 0) { next = i; continue; }
+
+                const auto& best = m_fixedTicks[next];
+                if (e.nextTime < best.nextTime - eps ||
+                    (std::abs(e.nextTime - best.nextTime) <= eps && e.desc.order < best.desc.order)) {
+                    next = i;
+                }
+            }
+            if (next < 0) break;
+
+            auto& entry = m_fixedTicks[next];
+            if (entry.desc.budgetMs > 0.0 && entry.stats.spentLastFrameMs >= entry.desc.budgetMs) {
+                //leave the remaining steps for the next frame
+                overBudget[next] = true;
+                entry.stats.deferredSteps += (uint32_t)std::floor((targetTime - entry.nextTime) / entry.dt + eps) + 1;
+                continue;
+            }
+
+            //callbacks see the time at the start of their step, as before
+            m_info.simTime = std::max(m_info.simTime, entry.nextTime - entry.dt);
+
+            auto beginTP = clock::now();
+            {
+                PROFILE_SCOPE(entry.profileName);
+                entry.callback((float)entry.dt);
+            }
+            double ms = duration<double, std::milli>(clock::now() - beginTP).count();
+
+            //the callback may have registered ticks, those wait in m_addedTicks, so the reference is still valid
+            entry.nextTime += entry.dt;
+            entry.stats.totalSteps++;
+            entry.stats.stepsLastFrame++;
+            entry.stats.lastStepMs = ms;
+            entry.stats.maxStepMs = std::max(entry.stats.maxStepMs, ms);
+            entry.stats.spentLastFrameMs += ms;
+        }
+
+        m_info.simTime = targetTime;
+        m_bTicking = false;
+    }
 
     void TimeSystem::SetPaused(bool p) { m_info.paused = p; }
     void TimeSystem::TogglePaused() { m_info.paused = !m_info.paused; }
     void TimeSystem::SetTimeScale(double s) { m_info.timeScale = std::max(0.0, s); }
-    void TimeSystem::SetFixedStepPolicy(const FixedStepPolicy& p) { m_policy = p; }
+
+    void TimeSystem::SetFixedStepPolicy(const FixedStepPolicy& p) {
+        m_policy = p;
+
+        //base-rate ticks follow the policy
+        ApplyOverloadLevel();
+    }
+
+    void TimeSystem::SetOverloadPolicy(const OverloadPolicy& p) {
+        m_overloadPolicy = p;
+        if (!m_overloadPolicy.bEnabled) SetOverloadLevel(EOverloadLevel::Normal);
+        ApplyOverloadLevel();
+    }
+
+    void TimeSystem::RegisterQualityListener(const std::function<void(EOverloadLevel)>& listener)
+    {
+        m_qualityCB.push_back(listener);
+    }
+
+    void TimeSystem::UpdateOverload(double pumpSeconds, int steps, double dropped) {
+        auto& m = m_overload;
+        const auto& p = m_overloadPolicy;
+
+        m.droppedLastFrame = dropped;
+        m.droppedTotal += dropped;
+
+        //share of real time the sim needs at the current dilation; past 1.0 it can never catch up
+        if (steps > 0) {
+            m.lastLoad = pumpSeconds / (steps * m_effectiveFixedDt) * m.dilation;
+            m.load += (m.lastLoad - m.load) * p.loadSmoothing;
+        }
+
+        bool bOverloaded = dropped > 0.0 || m.load > p.escalateLoad;
+        if (bOverloaded) ++m.overloadedFrames;
+        if (!p.bEnabled) return;
+
+        if (bOverloaded) {
+            m_framesBelow = 0;
+            ++m_framesAbove;
+        }
+        else if (m.load < p.recoverLoad) {
+            m_framesAbove = 0;
+            ++m_framesBelow;
+        }
+        else {
+            //in the hysteresis band, hold
+            m_framesAbove = m_framesBelow = 0;
+        }
+
+        //rungs disabled by the policy are skipped
+        auto allowed = [&](EOverloadLevel level) {
+            if (level == EOverloadLevel::StretchedStep) return p.bAllowStretch;
+            if (level == EOverloadLevel::Dilated) return p.bAllowDilation;
+            return true;
+            };
+
+        if (m_framesAbove >= p.escalateFrames) {
+            for (int l = (int)m.level + 1; l <= (int)EOverloadLevel::Dilated; ++l) {
+                if (!allowed((EOverloadLevel)l)) continue;
+                ++m.escalations;
+                SetOverloadLevel((EOverloadLevel)l);
+                break;
+            }
+            m_framesAbove = 0;
+        }
+        else if (m_framesBelow >= p.recoverFrames && m.level != EOverloadLevel::Normal) {
+            for (int l = (int)m.level - 1; l >= 0; --l) {
+                if (!allowed((EOverloadLevel)l)) continue;
+                ++m.recoveries;
+                SetOverloadLevel((EOverloadLevel)l);
+                break;
+            }
+            m_framesBelow = 0;
+        }
+
+        //dilation tracks the load: slow down just enough to sit inside the hysteresis band
+        if (m.level == EOverloadLevel::Dilated && m.load > 0.0) {
+            double bandLoad = 0.5 * (p.escalateLoad + p.recoverLoad);
+            double target = std::clamp(m.dilation * bandLoad / m.load, p.minDilation, 1.0);
+            m.dilation += (target - m.dilation) * p.loadSmoothing;
+        }
+    }
+
+    void TimeSystem::SetOverloadLevel(EOverloadLevel level) {
+        if (m_overload.level == level) return;
+
+        std::cout << "[TimeSystem] overload level " << (int)m_overload.level << " -> " << (int)level
+            << ", load: " << m_overload.load << '\n';
+
+        m_overload.level = level;
+        ApplyOverloadLevel();
+
+        for (auto& listener : m_qualityCB) listener(level);
+    }
+
+    void TimeSystem::ApplyOverloadLevel() {
+        const auto& p = m_overloadPolicy;
+        const auto level = m_overload.level;
+
+        m_overload.effectiveCatchupSteps = level >= EOverloadLevel::ReducedCatchup
+            ? std::clamp(p.reducedCatchupSteps, 1, m_policy.maxCatchupSteps)
+            : m_policy.maxCatchupSteps;
+
+        double stretch = (level >= EOverloadLevel::StretchedStep && p.bAllowStretch) ? std::max(1.0, p.maxStretch) : 1.0;
+        m_effectiveFixedDt = m_policy.fixedDt * stretch;
+        m_overload.effectiveFixedDt = m_effectiveFixedDt;
+
+        if (level < EOverloadLevel::Dilated) m_overload.dilation = 1.0;
+
+        //base-rate ticks follow the effective step
+        for (auto& entry : m_fixedTicks) {
+            if (entry.desc.rateHz <= 0.0) entry.dt = m_effectiveFixedDt;
+        }
+        for (auto& entry : m_addedTicks) {
+            if (entry.desc.rateHz <= 0.0) entry.dt = m_effectiveFixedDt;
+        }
+    }
 
     void TimeSystem::RegisterFixedFrame(const EntryFixed& fixed)
     {
-        m_fixedCB.push_back(fixed);
+        FixedTickDesc desc;
+        desc.name = "FixedFrame";
+        RegisterFixedTick(desc, fixed);
+    }
+
+    FixedTickHandle TimeSystem::RegisterFixedTick(const FixedTickDesc& desc, const EntryFixed& fixed)
+    {
+        assert(fixed && "fixed tick without callback");
+
+        FixedTickEntry entry;
+        entry.handle = m_nextFixedHandle++;
+        entry.desc = desc;
+        entry.callback = fixed;
+        entry.profileName = FProfiler::Get().InternName(desc.name);
+        entry.dt = desc.rateHz > 0.0 ? 1.0 / desc.rateHz : m_effectiveFixedDt;
+
+        //first step one period from now, minus the phase slot
+        entry.nextTime = m_info.simTime + entry.dt - AmortizedPhase(entry);
+
+        //don't grow the vector under a running callback
+        if (m_bTicking) m_addedTicks.push_back(std::move(entry));
+        else m_fixedTicks.push_back(std::move(entry));
+
+        return m_nextFixedHandle - 1;
+    }
+
+    void TimeSystem::UnregisterFixedTick(FixedTickHandle handle)
+    {
+        if (auto* entry = FindFixedTick(handle)) entry->bRemoved = true;
+
+        if (!m_bTicking) {
+            m_fixedTicks.erase(std::remove_if(m_fixedTicks.begin(), m_fixedTicks.end(),
+                [](const FixedTickEntry& e) { return e.bRemoved; }), m_fixedTicks.end());
+        }
+    }
+
+    const FixedTickStats* TimeSystem::GetFixedTickStats(FixedTickHandle handle) const
+    {
+        for (auto& entry : m_fixedTicks) {
+            if (entry.handle == handle && !entry.bRemoved) return &entry.stats;
+        }
+        for (auto& entry : m_addedTicks) {
+            if (entry.handle == handle && !entry.bRemoved) return &entry.stats;
+        }
+        return nullptr;
+    }
+
+    TimeSystem::FixedTickEntry* TimeSystem::FindFixedTick(FixedTickHandle handle)
+    {
+        for (auto& entry : m_fixedTicks) {
+            if (entry.handle == handle) return &entry;
+        }
+        for (auto& entry : m_addedTicks) {
+            if (entry.handle == handle) return &entry;
+        }
+        return nullptr;
+    }
+
+    double TimeSystem::AmortizedPhase(const FixedTickEntry& entry) const
+    {
+        //only ticks slower than the base rate have frames to spread over
+        int period = (int)std::lround(entry.dt / m_effectiveFixedDt);
+        if (!entry.desc.bAmortize || period <= 1) return 0.0;
+
+        int slot = 0;
+        auto countSameRate = [&](const std::vector<FixedTickEntry>& list) {
+            for (auto& other : list) {
+                if (!other.bRemoved && other.desc.bAmortize && std::abs(other.dt - entry.dt) < 1e-12) ++slot;
+            }
+            };
+        countSameRate(m_fixedTicks);
+        countSameRate(m_addedTicks);
+
+        return (slot % period) * m_effectiveFixedDt;
     }
 
     double TimeSystem::GetFixedAlpha() const
     {
-        return std::clamp(m_accumulator / m_policy.fixedDt, 0.0, 1.0);
+        return std::clamp(m_accumulator / m_effectiveFixedDt, 0.0, 1.0);
     }
 
     void TimeSystem::AdvanceFrames(int frames) { if (m_info.paused) m_pendingFrameSteps += std::max(0, frames); }
     void TimeSystem::AdvanceFixedSteps(int st) { if (m_info.paused) m_pendingFixedSteps += std::max(0, st); }
 
-
-    //void TimeSystem::RegisterFixed(ITickFixed* t, int order) {
-//    m_fixed.push_back({ t, order });
-//    m_dirtyOrder = true;
-//}
-//void TimeSystem::RegisterFrame(ITickFrame* t, int order) {
-//    m_frame.push_back({ t, order });
-//    m_dirtyOrder = true;
-//}
-//void TimeSystem::UnregisterFixed(ITickFixed* t) {
-//    m_fixed.erase(std::remove_if(m_fixed.begin(), m_fixed.end(),
-//        [&](auto& e) {return e.t == t;}), m_fixed.end());
-//}
-//void TimeSystem::UnregisterFrame(ITickFrame* t) {
-//    m_frame.erase(std::remove_if(m_frame.begin(), m_frame.end(),
-//        [&](auto& e) {return e.t == t;}), m_frame.end());
-//}
-
-//void TimeSystem::sortRegistriesIfNeeded() {
-//    if (!m_dirtyOrder) return;
-//    std::sort(m_fixed.begin(), m_fixed.end(), [](auto& a, auto& b) {return a.order < b.order;});
-//    std::sort(m_frame.begin(), m_frame.end(), [](auto& a, auto& b) {return a.order < b.order;});
-//    m_dirtyOrder = false;
-//}
-
-
-}
\ No newline at end of file
+}
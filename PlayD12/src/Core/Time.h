@@ -6,32 +6,18 @@
 #include <string>
 #include <functional>
 #include <optional>
+#include <array>
+#include <mutex>
 
 /*
 * TP = timepoint
 
-
+* fixed ticks:
+* every registered callback has its own rate; the base rate (policy fixedDt) drives how far
+* simulated time advances per frame, then all callbacks due up to that time run in time order,
+* ties broken by their explicit order.
 */
 ////optional registery;  i don't like interface so i make it callback;
-//struct ITickFixed {
-//    virtual ~ITickFixed() = default;
-//    virtual void TickFixed(double fixedDt) = 0;
-//};
-//
-//struct ITickFrame {
-//    virtual ~ITickFrame() = default;
-//    virtual void TickFrame(double dt) = 0;
-//};
-
-// registration
-//void RegisterFixed(ITickFixed* t, int order = 0);
-//void RegisterFrame(ITickFrame* t, int order = 0);
-//void UnregisterFixed(ITickFixed* t);
-//void UnregisterFrame(ITickFrame* t);
-
-// helpers
-//void sortRegistriesIfNeeded();
-//bool m_dirtyOrder = false;
 
 namespace System {
 
@@ -49,12 +35,101 @@ namespace System {
         int    maxCatchupSteps = 4;   // prevent spiral-of-death
     };
 
+    /*
+    * overload ladder, one rung per sustained overload, one back per sustained recovery:
+    * ReducedCatchup: fewer catch-up steps per frame, the extra time is dropped but the cost is bounded
+    * StretchedStep:  base fixedDt is stretched, fewer steps per simulated second
+    * Dilated:        the accumulator is fed slower than real time, sim runs in slow motion, nothing dropped
+    * every change is pushed to the quality listeners, so systems can lower their own cost
+    */
+    enum class EOverloadLevel : uint8_t {
+        Normal = 0,
+        ReducedCatchup,
+        StretchedStep,
+        Dilated,
+    };
+
+    struct OverloadPolicy {
+        bool   bEnabled = true;
+        double escalateLoad = 0.8;    // fixed-step wall time per real second, at the current dilation
+        double recoverLoad = 0.5;
+        int    escalateFrames = 30;   // sustained frames before moving a rung
+        int    recoverFrames = 120;
+        double loadSmoothing = 0.1;   // EMA factor
+
+        int    reducedCatchupSteps = 1;
+        bool   bAllowStretch = true;  // lockstep servers turn this off, dt must stay identical on all peers
+        double maxStretch = 2.0;
+        bool   bAllowDilation = true;
+        double minDilation = 0.25;
+    };
+
+    struct OverloadMetrics {
+        EOverloadLevel level = EOverloadLevel::Normal;
+        double load = 0.0;              // smoothed
+        double lastLoad = 0.0;
+        double effectiveFixedDt = 0.0;
+        int    effectiveCatchupSteps = 0;
+        double dilation = 1.0;          // sim seconds per real second
+        double droppedLastFrame = 0.0;  // sim seconds thrown away by the catch-up cap
+        double droppedTotal = 0.0;
+        uint64_t overloadedFrames = 0;
+        uint32_t escalations = 0;
+        uint32_t recoveries = 0;
+    };
+
+    /*
+    * frame pacing: WaitForNextFrame at the top of the loop holds the frame start on a
+    * targetFrameTime grid. the wait is an OS sleep that stops spinWindow short, then a spin to the exact time.
+    * low latency: the time the previous frame spent blocked in present is slack, the next frame starts
+    * that much later, so input is sampled closer to the present that shows it.
+    */
+    struct FramePacingPolicy {
+        double targetFrameTime = 0.0;    // seconds, 0: unlimited
+        double spinWindow = 0.002;       // tail of the wait that is spun instead of slept
+        bool   bLowLatency = false;
+        double lowLatencyMargin = 0.002; // slack kept back in low latency mode, guards against misses
+    };
+
+    struct FramePacingMetrics {
+        double lastWaitMs = 0.0;         // total limiter wait of the last frame
+        double lastSpinMs = 0.0;         // of which spun
+        double lowLatencyDelayMs = 0.0;
+        double presentWaitMs = 0.0;      // smoothed
+        double inputToPresentMs = 0.0;   // smoothed
+        double lastInputToPresentMs = 0.0;
+        double maxInputToPresentMs = 0.0;
+        uint64_t presentedFrames = 0;
+    };
+
+    using FixedTickHandle = uint32_t;
+    constexpr FixedTickHandle InvalidFixedTick = 0;
+
+    struct FixedTickDesc {
+        std::string name = "FixedTick";
+        double rateHz = 0.0;     // 0: base rate, follows fixedDt and its overload stretch
+        int    order = 0;        // lower runs first when ticks are due at the same time
+        double budgetMs = 0.0;   // 0: unlimited; else steps beyond the budget are deferred to later frames
+        bool   bAmortize = true; // phase-shift ticks of the same rate so they fire on different frames
+    };
+
+    struct FixedTickStats {
+        uint64_t totalSteps = 0;
+        uint32_t stepsLastFrame = 0;
+        uint32_t deferredSteps = 0;   // postponed by the budget
+        uint32_t droppedSteps = 0;    // backlog thrown away beyond the catch-up window
+        double   lastStepMs = 0.0;
+        double   maxStepMs = 0.0;
+        double   spentLastFrameMs = 0.0;
+    };
+
     class TimeSystem {
 
         using EntryFixed = std::function<void(float)>;
 
     public:
         TimeSystem();
+        ~TimeSystem();
 
         // frame boundaries
         void BeginFrame();
@@ -77,8 +152,25 @@ namespace System {
         // query
         const FrameTimeInfo& GetTimeInfo() const { return m_info; }
 
+        // pacing, WaitForNextFrame before BeginFrame; the marks may come from any thread
+        void SetFramePacing(const FramePacingPolicy& p);
+        void WaitForNextFrame();
+        void MarkInputSampled(uint64_t frame);
+        void MarkPresented(uint64_t frame, double presentWaitSeconds = 0.0);
+        FramePacingMetrics GetFramePacingMetrics() const;
+
+        // overload
+        void SetOverloadPolicy(const OverloadPolicy& p);
+        const OverloadMetrics& GetOverloadMetrics() const { return m_overload; }
+        void RegisterQualityListener(const std::function<void(EOverloadLevel)>& listener);
+
+        // base rate, order 0; kept for existing callers
         void RegisterFixedFrame(const EntryFixed& fixed);
 
+        FixedTickHandle RegisterFixedTick(const FixedTickDesc& desc, const EntryFixed& fixed);
+        void UnregisterFixedTick(FixedTickHandle handle);
+        const FixedTickStats* GetFixedTickStats(FixedTickHandle handle) const;
+
         double GetFixedAlpha() const;
     private:
         // policy & state
@@ -89,10 +181,49 @@ namespace System {
         int m_pendingFrameSteps = 0;
 
         // registries
-        //struct EntryF { ITickFixed* t; int order; };
-        //struct EntryV { ITickFrame* t; int order; };
-        std::vector<EntryFixed> m_fixedCB;
-        //std::vector<EntryV> m_frameCB;
+        struct FixedTickEntry {
+            FixedTickHandle handle = InvalidFixedTick;
+            FixedTickDesc desc;
+            EntryFixed callback;
+            const char* profileName = "FixedTick";
+
+            double dt = 0.0;
+            double nextTime = 0.0;   // sim time of the next step
+            bool bRemoved = false;
+
+            FixedTickStats stats;
+        };
+        std::vector<FixedTickEntry> m_fixedTicks;
+        std::vector<FixedTickEntry> m_addedTicks;   // registered from inside a tick, merged after the pump
+        FixedTickHandle m_nextFixedHandle = 1;
+        bool m_bTicking = false;
+
+        // overload state
+        OverloadPolicy m_overloadPolicy;
+        OverloadMetrics m_overload;
+        double m_effectiveFixedDt = 0.0;
+        int m_framesAbove = 0;
+        int m_framesBelow = 0;
+        std::vector<std::function<void(EOverloadLevel)>> m_qualityCB;
+
+        void UpdateOverload(double pumpSeconds, int steps, double dropped);
+        void SetOverloadLevel(EOverloadLevel level);
+        void ApplyOverloadLevel();
+
+        // pacing state
+        FramePacingPolicy m_pacing;
+        FramePacingMetrics m_pacingMetrics;
+        mutable std::mutex m_pacingMutex;
+        std::chrono::steady_clock::time_point m_frameStartTP{};
+        static constexpr uint32_t kLatencySlots = 8;   // frames that may be in flight between input and present
+        std::array<std::chrono::steady_clock::time_point, kLatencySlots> m_inputTP{};
+        void* m_waitTimer = nullptr;
+
+        void SleepUntil(std::chrono::steady_clock::time_point tp, double& sleptMs, double& spunMs);
+
+        FixedTickEntry* FindFixedTick(FixedTickHandle handle);
+        double AmortizedPhase(const FixedTickEntry& entry) const;
+        void RunFixedTicks(double targetTime);
 
     private:
         using clock = std::chrono::steady_clock;
@@ -105,4 +236,26 @@ namespace System {
     };
 
 
-}
\ No newline at end of file
+}
+
+/*
+Usage:
+
+auto handle = gTime->RegisterFixedTick({ .name = "AI", .rateHz = 20.0, .order = 10, .budgetMs = 2.0 },
+    [&](float dt) { aiSystem.Tick(dt); });
+
+if (auto* stats = gTime->GetFixedTickStats(handle)) { stats->deferredSteps; }
+gTime->UnregisterFixedTick(handle);
+
+OverloadPolicy overload;
+overload.bAllowStretch = false;   // lockstep server: degrade by dilation, never change dt
+gTime->SetOverloadPolicy(overload);
+gTime->RegisterQualityListener([&](System::EOverloadLevel level) { particles.SetBudget((int)level); });
+
+gTime->SetFramePacing({ .targetFrameTime = 1.0 / 60.0, .bLowLatency = true });
+while (running) {
+    gTime->WaitForNextFrame();
+    gTime->BeginFrame();
+    ...
+}
+*/
@@ -10,6 +10,7 @@ enum class KeyCode : uint16_t {
     Num0, Num1, Num2, Num3, Num4, Num5, Num6, Num7, Num8, Num9,
     Space, Enter, Escape, Tab, Backspace,
     Left, Right, Up, Down,
+    F1, F2, F3, F4, F5, F6, F7, F8, F9, F10, F11, F12,
 
     MAX_COUNT,
 };
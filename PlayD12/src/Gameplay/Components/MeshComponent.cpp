@@ -29,7 +29,9 @@ void Gameplay::UStaticMeshComponent::OnRegister()
 
 FStaticMeshProxy Gameplay::UStaticMeshComponent::CreateSceneProxy()
 {
-    auto instanceData = DebugGenerateInstanceData();
+    if (m_instanceData.empty()) {
+        m_instanceData = DebugGenerateInstanceData();
+    }
 
     //std::cout << "mesh world scale: " << ToString(this->GetWorldScale()) << '\n';
 
@@ -37,8 +39,8 @@ FStaticMeshProxy Gameplay::UStaticMeshComponent::CreateSceneProxy()
 .modelMatrix = this->GetWorldTransform().ToMatrix(),
 .mesh = m_mesh.get(),
 .material = m_material.get(),
-.instanceData = instanceData.data(),
-.instanceCount = instanceData.size(),
+.instanceData = m_instanceData.data(),
+.instanceCount = m_instanceData.size(),
     };
     return proxy;
 }
\ No newline at end of file
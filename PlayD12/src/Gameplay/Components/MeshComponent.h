@@ -52,7 +52,8 @@ namespace Gameplay {
         //bool GetCastShadow() const;
 
     protected:
-        //std::vector<InstanceData> m_instanceData; 
+        //owned here, proxies only point into it and may be read a frame later by the render thread
+        std::vector<InstanceData> m_instanceData; 
         //int m_currentLOD = 0;
         //bool m_castShadow = true;
 
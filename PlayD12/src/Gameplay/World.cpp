@@ -6,6 +6,8 @@
 
 #include "Physics/PhysicsEvent.h"
 
+#include "Core/Profiler.h"
+
 namespace Gameplay {
 
 	void UWorld::Init()
@@ -14,7 +16,7 @@ namespace Gameplay {
 		physicsScene->OnInit();
 
 		//physics update is handled by time system;
-		gTime->RegisterFixedFrame([=](float delta) {
+		gTime->RegisterFixedTick({ .name = "Physics", .order = 0 }, [=](float delta) {
 			physicsScene->Tick(delta);
 			this->SyncPhysicsToGame();
 			});
@@ -160,6 +162,7 @@ namespace Gameplay {
 
 	void UWorld::OnTick(float delta)
 	{
+		PROFILE_SCOPE("World::OnTick");
 
 		if (m_gameState) {
 			m_gameState->OnTick(delta);
@@ -179,6 +182,7 @@ namespace Gameplay {
 		}
 
 		//
+		PROFILE_SCOPE("World::SubmitScene");
 		this->ConstructSceneView();
 
 		//
@@ -33,6 +33,12 @@ static const std::unordered_map<int, KeyCode> WindowsKeyMap = {
     { VK_UP,    KeyCode::Up },
     { VK_DOWN,  KeyCode::Down },
 
+    // Function keys
+    { VK_F1, KeyCode::F1 }, { VK_F2, KeyCode::F2 }, { VK_F3, KeyCode::F3 },
+    { VK_F4, KeyCode::F4 }, { VK_F5, KeyCode::F5 }, { VK_F6, KeyCode::F6 },
+    { VK_F7, KeyCode::F7 }, { VK_F8, KeyCode::F8 }, { VK_F9, KeyCode::F9 },
+    { VK_F10, KeyCode::F10 }, { VK_F11, KeyCode::F11 }, { VK_F12, KeyCode::F12 },
+
     // Add more mappings if needed
 };
 
@@ -7,34 +7,54 @@
 
 #include "PhysicsEvent.h"
 
+#include "Core/JobSystem.h"
+#include "Core/Profiler.h"
+
 //using namespace DirectX;
 
 void PhysicsScene::Tick(float delta)
 {
 	//std::cout << "tick physics: " << delta << '\n';
+	PROFILE_SCOPE("Physics::Tick");
 
 	float substeps = 1;
 	float substepDelta = delta / substeps;
 
-	PreSimulation();
-
-	ApplyExternalForce(delta);
+	{
+		PROFILE_SCOPE("Physics::PreSimulation");
+		PreSimulation();
+		ApplyExternalForce(delta);
+	}
 
 	for (int i = 0; i < substeps; ++i) {
 
-		Integrate(substepDelta);
-
-		DetectCollisions();
+		{
+			PROFILE_SCOPE("Physics::Integrate");
+			Integrate(substepDelta);
+		}
 
-		SolveConstraints(substepDelta);
+		{
+			PROFILE_SCOPE("Physics::DetectCollisions");
+			DetectCollisions();
+		}
 
-		PostPBD(substepDelta);
+		{
+			PROFILE_SCOPE("Physics::SolveConstraints");
+			SolveConstraints(substepDelta);
+		}
 
-		VelocityPass(substepDelta);
+		{
+			PROFILE_SCOPE("Physics::PostPBD");
+			PostPBD(substepDelta);
+			VelocityPass(substepDelta);
+		}
 	}
 
 
-	PostSimulation(delta);
+	{
+		PROFILE_SCOPE("Physics::PostSimulation");
+		PostSimulation(delta);
+	}
 }
 
 void PhysicsScene::OnInit()
@@ -71,6 +91,12 @@ void PhysicsScene::PreSimulation()
 		body->invMass = 1 / body->mass;
 	}
 
+	//flat list for the parallel passes
+	m_simBodies.clear();
+	for (auto& [actor, body] : m_bodies) {
+		if (body->simulatePhysics) m_simBodies.push_back(body);
+	}
+
 
 	//DebugDraw::AddLine(Float3{ 0, 0, 0 }, Float3{ 5, 0, 0 }, Float4{ 1, 0, 0, 1 });
 	//DebugDraw::AddLine(Float3{ 0, 0, 0 }, Float3{ 0, 5, 0 }, Float4{ 0, 1, 0, 1 });
@@ -87,74 +113,79 @@ void PhysicsScene::ApplyExternalForce(float delta)
 
 void PhysicsScene::Integrate(float delta)
 {
-	for (auto& [actor, body] : m_bodies) {
-		if (!body->simulatePhysics) continue;
+	//bodies are independent here, split across the job pool
+	System::FJobSystem::Get().ParallelFor((uint32_t)m_simBodies.size(), 64,
+		[&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			RigidBody* body = m_simBodies[i];
+			if (!body->simulatePhysics) continue;
 
-		//std::cout << "integrate for rb: " << ToString(rb->force ) << '\n';
-		body->linearVelocity = body->linearVelocity + body->force / body->mass * delta;
-		body->force = Float3{};
+			//std::cout << "integrate for rb: " << ToString(rb->force ) << '\n';
+			body->linearVelocity = body->linearVelocity + body->force / body->mass * delta;
+			body->force = Float3{};
 
-		//cache the previous position:
-		body->prevPos = body->position;
+			//cache the previous position:
+			body->prevPos = body->position;
 
-		//predicated position:
-		body->predPos = body->position + body->linearVelocity * delta;
+			//predicated position:
+			body->predPos = body->position + body->linearVelocity * delta;
 
-		if (!body->simulateRotation) {
-			continue;
-		}
-		//new: consider torque: 
+			if (!body->simulateRotation) {
+				continue;
+			}
+			//new: consider torque: 
 
-		//rb->angularVelocity = rb->angularVelocity + Inverse3x3(rb->worldInertia) * rb->torque * delta;
-		//rb->torque = Float3{}; //reset torque 
+			//rb->angularVelocity = rb->angularVelocity + Inverse3x3(rb->worldInertia) * rb->torque * delta;
+			//rb->torque = Float3{}; //reset torque 
 
-		//
-		body->prevRot = body->rotation;
+			//
+			body->prevRot = body->rotation;
 
 
-		//mark:
-		//XMVECTOR omegaW = XMVectorSet(body->angularVelocity.x(), body->angularVelocity.y(), body->angularVelocity.z(), 0.0f);
-		//XMVECTOR dq = XMQuaternionMultiply(body->rotation, omegaW);
-		//dq = XMVectorScale(dq, 0.5f * delta);
-		//body->predRot = XMQuaternionNormalize(XMVectorAdd(dq, body->predRot));
+			//mark:
+			//XMVECTOR omegaW = XMVectorSet(body->angularVelocity.x(), body->angularVelocity.y(), body->angularVelocity.z(), 0.0f);
+			//XMVECTOR dq = XMQuaternionMultiply(body->rotation, omegaW);
+			//dq = XMVectorScale(dq, 0.5f * delta);
+			//body->predRot = XMQuaternionNormalize(XMVectorAdd(dq, body->predRot));
 
-		// Build "pure quaternion" from angular velocity
-		Quaternion omegaQ = { body->angularVelocity.x(),
-							  body->angularVelocity.y(),
-							  body->angularVelocity.z(),
-							  0.0f };
+			// Build "pure quaternion" from angular velocity
+			Quaternion omegaQ = { body->angularVelocity.x(),
+								  body->angularVelocity.y(),
+								  body->angularVelocity.z(),
+								  0.0f };
 
-		// dq = q * omega
-		Quaternion dq = QuaternionMultiply(omegaQ, body->rotation);
+			// dq = q * omega
+			Quaternion dq = QuaternionMultiply(omegaQ, body->rotation);
 
-		// scale by 0.5 * delta
-		dq = QuaternionScale(dq, 0.5f * delta);
+			// scale by 0.5 * delta
+			dq = QuaternionScale(dq, 0.5f * delta);
 
-		// integrate: predRot = normalize(predRot + dq)
-		body->predRot = QuaternionNormalize(QuaternionAdd(body->predRot, dq));
+			// integrate: predRot = normalize(predRot + dq)
+			body->predRot = QuaternionNormalize(QuaternionAdd(body->predRot, dq));
 
 
-		/*	std::cout << "integrate for rb : " << rb->debugName << '\n';
-			std::cout << "dq: " << MMath::XMToString(dq) << '\n';*/
+			/*	std::cout << "integrate for rb : " << rb->debugName << '\n';
+				std::cout << "dq: " << MMath::XMToString(dq) << '\n';*/
 
-			//update pose;
-			//XMMATRIX R_ = XMMatrixRotationQuaternion(rb->predRot);
-		//XMMATRIX R_ = XMMatrixRotationQuaternion(body->predRot);
-		//XMMATRIX invR_ = XMMatrixTranspose(R_);
+				//update pose;
+				//XMMATRIX R_ = XMMatrixRotationQuaternion(rb->predRot);
+			//XMMATRIX R_ = XMMatrixRotationQuaternion(body->predRot);
+			//XMMATRIX invR_ = XMMatrixTranspose(R_);
 
-		//Float3x3 R;
-		//R[0] = { R_.r[0].m128_f32[0], R_.r[0].m128_f32[1], R_.r[0].m128_f32[2] };
-		//R[1] = { R_.r[1].m128_f32[0], R_.r[1].m128_f32[1], R_.r[1].m128_f32[2] };
-		//R[2] = { R_.r[2].m128_f32[0], R_.r[2].m128_f32[1], R_.r[2].m128_f32[2] };
+			//Float3x3 R;
+			//R[0] = { R_.r[0].m128_f32[0], R_.r[0].m128_f32[1], R_.r[0].m128_f32[2] };
+			//R[1] = { R_.r[1].m128_f32[0], R_.r[1].m128_f32[1], R_.r[1].m128_f32[2] };
+			//R[2] = { R_.r[2].m128_f32[0], R_.r[2].m128_f32[1], R_.r[2].m128_f32[2] };
 
-		Float3x3 R = MatrixRotationQuaternion(body->predRot);
-		body->RotationMatrix = R;
+			Float3x3 R = MatrixRotationQuaternion(body->predRot);
+			body->RotationMatrix = R;
 
 
-		auto worldInertia = MatrixMultiply(MatrixMultiply(R, body->localInertia), Transpose(R));
-		body->worldInertia = worldInertia;
-		body->invWorldInertia = Inverse3x3(worldInertia);
-	}
+			auto worldInertia = MatrixMultiply(MatrixMultiply(R, body->localInertia), Transpose(R));
+			body->worldInertia = worldInertia;
+			body->invWorldInertia = Inverse3x3(worldInertia);
+		}
+		});
 }
 
 
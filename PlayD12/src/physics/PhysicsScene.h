@@ -272,6 +272,8 @@ private:
 private:
 	std::unordered_map<ActorId, RigidBody*> m_bodies;
 	std::unordered_map<ActorId, Collider*> m_colliders;
+	//simulated bodies of the current tick, rebuilt in PreSimulation
+	std::vector<RigidBody*> m_simBodies;
 	//std::vector<Collider* > m_colliders;
 	std::vector<Contact>  m_contacts;
 	//std::vector<Constraints* > m_constraints;
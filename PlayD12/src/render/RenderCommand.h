@@ -3,36 +3,62 @@
 #include <functional>
 #include <vector>
 #include <mutex>
+#include <cassert>
 
  
+    //todo: generic untyped std::function is not opt for perf.; but trivial to implement;
     using RenderCommand = std::function<void()>;
  
+    /*
+    * frame-ring of command lists:
+    * game side records into the open frame and closes it with SwapBuffers at the frame handoff,
+    * render side executes closed frames in order.
+    * MaxFrameLatency closed frames may be pending, so simulation can run ahead of the render thread;
+    * one more slot covers the frame being closed while the render thread has not picked up the last one.
+    */
     class RenderCommandBuffer {
     public:
-        RenderCommandBuffer() : m_writeIndex(0), m_readIndex(1) {}
+        static constexpr int MaxFrameLatency = 2;
+        static constexpr int NumBuffers = MaxFrameLatency + 2;
+
+        RenderCommandBuffer() : m_writeIndex(0), m_numClosed(0) {}
  
         void Enqueue(RenderCommand cmd) {
             std::lock_guard<std::mutex> lock(m_mutex);
             m_commandBuffers[m_writeIndex].push_back(std::move(cmd));
         }
          
+        //render side: run the oldest closed frame, if any
         void Execute() {
-            auto& cmds = m_commandBuffers[m_readIndex];
+            int readIndex;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_numClosed == 0) return;
+                readIndex = (m_writeIndex - m_numClosed + NumBuffers) % NumBuffers;
+            }
+
+            auto& cmds = m_commandBuffers[readIndex];
             for (auto& cmd : cmds) {
                 cmd();
             }
             cmds.clear();
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_numClosed;
         }
  
+        //game side: close the recording frame, later Enqueues go to the next one
         void SwapBuffers() {
             std::lock_guard<std::mutex> lock(m_mutex);
-            std::swap(m_writeIndex, m_readIndex);
+            assert(m_numClosed <= MaxFrameLatency && "render thread is too far behind");
+            m_writeIndex = (m_writeIndex + 1) % NumBuffers;
+            ++m_numClosed;
         }
 
     private:
-        std::vector<RenderCommand> m_commandBuffers[2]; //double buffering
+        std::vector<RenderCommand> m_commandBuffers[NumBuffers];
         int m_writeIndex;
-        int m_readIndex;
+        int m_numClosed;
         std::mutex m_mutex;
     };
 
@@ -8,6 +8,8 @@
 
 #include "Asset.h"
 
+#include "Core/Profiler.h"
+
 using namespace DirectX;
 
 D3D12HelloRenderer::D3D12HelloRenderer(UINT width, UINT height, std::wstring name,
@@ -23,11 +25,22 @@ D3D12HelloRenderer::D3D12HelloRenderer(UINT width, UINT height, std::wstring nam
 
 void D3D12HelloRenderer::ConsumeCmdBuffer()
 {
-    //new: execute read buffer
-    cmdBuffer.SwapBuffers();
+    //new: execute the oldest frame closed by EndGameFrame
     cmdBuffer.Execute();
 }
 
+void D3D12HelloRenderer::EndGameFrame()
+{
+    cmdBuffer.SwapBuffers();
+}
+
+void D3D12HelloRenderer::SubmitFrameTime(float engineTime)
+{
+    cmdBuffer.Enqueue([=] {
+        m_frameEngineTime = engineTime;
+        });
+}
+
 
 //void D3D12HelloRenderer::SubmitCamera(const FCameraProxy& camera)
 //{
@@ -39,23 +52,26 @@ void D3D12HelloRenderer::ConsumeCmdBuffer()
 
 void D3D12HelloRenderer::SubmitCamera(const FSceneView& sceneView)
 {
-    sceneCBData.pvMatrix = sceneView.pvMatrix;
-    sceneCBData.invProj = sceneView.invProjMatrix;
-    sceneCBData.invView = sceneView.invViewMatrix;
-    sceneCBData.cameraPos = sceneView.position;
+    //deferred like meshes, the render thread may still be drawing the previous frame
+    cmdBuffer.Enqueue([=] {
+        sceneCBData.pvMatrix = sceneView.pvMatrix;
+        sceneCBData.invProj = sceneView.invProjMatrix;
+        sceneCBData.invView = sceneView.invViewMatrix;
+        sceneCBData.cameraPos = sceneView.position;
+        });
 }
 
 
 // Update frame-based values.  make sure comes before OnRender;
 void D3D12HelloRenderer::OnUpdate(float delta)
 {
+    PROFILE_SCOPE("Render::OnUpdate");
     
     this->ConsumeCmdBuffer(); 
 
     //new:
-    auto timeSystem = GameApplication::GetInstance()->GetTimeSystem();
     sceneCBData.OnTick();
-    sceneCBData.time = static_cast<float>(timeSystem->GetTimeInfo().engineTime);
+    sceneCBData.time = m_frameEngineTime;
     sceneCBData.deltaTime = delta;
     sceneCBData.viewportSize = { (float)m_width, (float)m_height };
     //this->sceneCB->UploadData(&sceneCBData, sizeof(SceneCB));
@@ -144,56 +160,73 @@ void D3D12HelloRenderer::OnRender()
     // Record all the commands we need to render the scene into the command list.
     //PopulateCommandList();  
 
+    PROFILE_SCOPE("Render::OnRender");
+
     //GPU-side cmdList ; 
     //comes before the building of drawcmd;
-    BeginFrame();
+    {
+        PROFILE_SCOPE("Render::BeginFrame");
+        BeginFrame();
 
-    //CPU-side
-    //before the transparent pass
-    DebugDraw::BeginFrame(debugRayCtx);
-    DebugMesh::BeginFrame(debugMeshCtx);
+        //CPU-side
+        //before the transparent pass
+        DebugDraw::BeginFrame(debugRayCtx);
+        DebugMesh::BeginFrame(debugMeshCtx);
 
-    UI::BeginFrame(uiPassCtx);
-    Shadow::BeginFrame(shadowPassCtx);
-    GBuffer::BeginFrame(gbufferPassCtx);
-    PBR::BeginFrame(pbrShadingCtx);
+        UI::BeginFrame(uiPassCtx);
+        Shadow::BeginFrame(shadowPassCtx);
+        GBuffer::BeginFrame(gbufferPassCtx);
+        PBR::BeginFrame(pbrShadingCtx);
 
-    playerTex->Dispatch();
+        playerTex->Dispatch();
+    }
 
     //rg->Execute(m_commandList.Get());
 
     //
-    BeginShadowPass(m_commandList.Get());
+    {
+        PROFILE_SCOPE("Render::ShadowPass");
+        BeginShadowPass(m_commandList.Get());
 
-    Shadow::FlushAndRender(m_commandList.Get(), shadowPassCtx);
+        Shadow::FlushAndRender(m_commandList.Get(), shadowPassCtx);
 
-    EndShadowPass(m_commandList.Get());
+        EndShadowPass(m_commandList.Get());
+    }
 
     //
-    BeginGBufferPass(m_commandList.Get());
+    {
+        PROFILE_SCOPE("Render::GBufferPass");
+        BeginGBufferPass(m_commandList.Get());
 
-    GBuffer::FlushAndRender(m_commandList.Get(), gbufferPassCtx);
+        GBuffer::FlushAndRender(m_commandList.Get(), gbufferPassCtx);
 
-    EndGBufferPass(m_commandList.Get());
+        EndGBufferPass(m_commandList.Get());
+    }
 
 
     //
-    BeginPresentPass(m_commandList.Get());
+    {
+        PROFILE_SCOPE("Render::PresentPass");
+        BeginPresentPass(m_commandList.Get());
 
-    PBR::FlushAndRender(m_commandList.Get(), pbrShadingCtx);
+        PBR::FlushAndRender(m_commandList.Get(), pbrShadingCtx);
 
-    UI::FlushAndRender(m_commandList.Get(), uiPassCtx);
+        UI::FlushAndRender(m_commandList.Get(), uiPassCtx);
 
-    DebugMesh::FlushAndRender(m_commandList.Get(), debugMeshCtx);
+        DebugMesh::FlushAndRender(m_commandList.Get(), debugMeshCtx);
 
-    DebugDraw::FlushAndRender(m_commandList.Get(), debugRayCtx);
-    //DebugDraw::Get().FlushAndRender(m_commandList.Get());  
+        DebugDraw::FlushAndRender(m_commandList.Get(), debugRayCtx);
+        //DebugDraw::Get().FlushAndRender(m_commandList.Get());  
 
-    EndPresentPass(m_commandList.Get());
+        EndPresentPass(m_commandList.Get());
+    }
 
 
     //
-    EndFrame();
+    {
+        PROFILE_SCOPE("Render::EndFrame");
+        EndFrame();
+    }
 
     // 
     UI::EndFrame(uiPassCtx);
@@ -617,6 +650,8 @@ void D3D12HelloRenderer::EndFrame()
     ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
     m_commandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
 
+    auto presentTP = std::chrono::steady_clock::now();
+
     // Present the frame.
     ThrowIfFailed(m_swapChain->Present(1, 0));
 
@@ -625,6 +660,8 @@ void D3D12HelloRenderer::EndFrame()
 
     WaitForPreviousFrame();
 
+    m_lastPresentWait = std::chrono::duration<double>(std::chrono::steady_clock::now() - presentTP).count();
+
 
     //new:
     m_frame->clear();
@@ -33,39 +33,7 @@
 
 
 //todo: is there any cases the renderer might access a dangling ptr?
-
-//todo: generic untyped std::function is not opt for perf.; but trivial to implement;
-using RenderCommand = std::function<void()>;
-
-//double buffering
-class RenderCommandBuffer {
-public:
-    RenderCommandBuffer() : m_writeIndex(0), m_readIndex(1) {}
-
-    void Enqueue(RenderCommand cmd) {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_commandBuffers[m_writeIndex].push_back(std::move(cmd));
-    }
-
-    void Execute() {
-        auto& cmds = m_commandBuffers[m_readIndex];
-        for (auto& cmd : cmds) {
-            cmd();
-        }
-        cmds.clear();
-    }
-
-    void SwapBuffers() {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        std::swap(m_writeIndex, m_readIndex);
-    }
-
-private:
-    std::vector<RenderCommand> m_commandBuffers[2];
-    int m_writeIndex;
-    int m_readIndex;
-    std::mutex m_mutex;
-};
+#include "RenderCommand.h"
 
 
 
@@ -286,6 +254,12 @@ public:
     //void SubmitCamera(const FCameraProxy& camera);
     void SubmitCamera(const FSceneView& sceneView);
 
+    //game-side snapshot handed over with each frame, the render thread never reads live game state
+    void SubmitFrameTime(float engineTime);
+
+    //frame handoff, called on the game side once a frame's submissions are complete
+    void EndGameFrame();
+
 
 public:
     Shadow::PassContext shadowPassCtx;
@@ -363,6 +337,17 @@ private:
     //new:
     RenderCommandBuffer cmdBuffer;
 
+    //render-thread copy of the game time, set through cmdBuffer
+    float m_frameEngineTime = 0.0f;
+
+    //seconds blocked in Present + the GPU fence wait of the last frame, slack for frame pacing
+    double m_lastPresentWait = 0.0;
+
+public:
+    double GetLastPresentWait() const { return m_lastPresentWait; }
+
+private:
+
     void ConsumeCmdBuffer();
 
 
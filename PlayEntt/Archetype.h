@@ -0,0 +1,405 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <new>
+#include <stdexcept>
+
+#include "ECS.h"
+
+using namespace std;
+
+
+/*
+* archetype storage mode:
+* actors with the same component signature share an archetype, stored in 16KB chunks;
+* each chunk holds SoA columns (actor ids first, then one column per component),
+* so a multi-component query streams every column linearly.
+* adding/removing a component moves the actor to the neighbouring archetype: one move per component.
+*/
+
+
+using CompTypeId = uint32_t;
+
+// what the chunk needs to move/destroy a component without knowing its type
+struct CompTypeInfo {
+	CompTypeId id;
+	size_t size;
+	size_t align;
+	void (*moveConstruct)(void* dst, void* src);
+	void (*destroy)(void* ptr);
+};
+
+inline CompTypeId nextCompTypeId()
+{
+	static atomic<CompTypeId> counter{ 0 };
+	return counter.fetch_add(1, memory_order_relaxed);
+}
+
+template<typename Comp_t>
+const CompTypeInfo& compTypeInfo()
+{
+	static const CompTypeInfo info{
+		nextCompTypeId(),
+		sizeof(Comp_t),
+		alignof(Comp_t),
+		[](void* dst, void* src) { new (dst) Comp_t(std::move(*static_cast<Comp_t*>(src))); },
+		[](void* ptr) { static_cast<Comp_t*>(ptr)->~Comp_t(); }
+	};
+	return info;
+}
+
+
+struct ArchetypeChunk {
+	static constexpr size_t SIZE = 16 * 1024;
+
+	alignas(64) std::byte data[SIZE];
+	uint32_t count = 0;
+};
+
+
+class Archetype {
+public:
+	// types sorted by id, the signature
+	explicit Archetype(vector<const CompTypeInfo*> sortedTypes)
+		: types(std::move(sortedTypes))
+	{
+		size_t rowBytes = sizeof(uint32_t);
+		for (auto* type : types) rowBytes += type->size;
+
+		// shrink until the aligned columns fit; a row that does not fit even alone has no chunk to live in
+		chunkCapacity = static_cast<uint32_t>(ArchetypeChunk::SIZE / rowBytes);
+		while (chunkCapacity > 1 && !layoutColumns(chunkCapacity)) --chunkCapacity;
+		if (chunkCapacity == 0 || !layoutColumns(chunkCapacity))
+			throw length_error("archetype row is larger than a chunk");
+	}
+
+	~Archetype()
+	{
+		for (auto& chunk : chunks) {
+			for (size_t col = 0; col < types.size(); ++col)
+				for (uint32_t row = 0; row < chunk->count; ++row)
+					types[col]->destroy(columnAt(*chunk, col, row));
+		}
+	}
+
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	int columnIndex(CompTypeId id) const
+	{
+		for (size_t i = 0; i < types.size(); ++i)
+			if (types[i]->id == id) return static_cast<int>(i);
+		return -1;
+	}
+
+	bool hasType(CompTypeId id) const { return columnIndex(id) >= 0; }
+
+	uint32_t* actorsOf(ArchetypeChunk& chunk) const
+	{
+		return reinterpret_cast<uint32_t*>(chunk.data);
+	}
+
+	void* columnAt(ArchetypeChunk& chunk, size_t col, uint32_t row) const
+	{
+		return chunk.data + columnOffsets[col] + static_cast<size_t>(row) * types[col]->size;
+	}
+
+	template<typename Comp_t>
+	Comp_t* column(ArchetypeChunk& chunk, size_t col) const
+	{
+		return reinterpret_cast<Comp_t*>(chunk.data + columnOffsets[col]);
+	}
+
+	// reserve a row at the end, component memory is left for the caller to construct
+	pair<uint32_t, uint32_t> allocateRow(uint32_t actor)
+	{
+		if (chunks.empty() || chunks.back()->count == chunkCapacity)
+			chunks.push_back(make_unique<ArchetypeChunk>());
+
+		auto& chunk = *chunks.back();
+		uint32_t row = chunk.count++;
+		actorsOf(chunk)[row] = actor;
+		++actorCount;
+		return { static_cast<uint32_t>(chunks.size() - 1), row };
+	}
+
+	// destroy the row and fill it with the last row;
+	// returns the actor that moved into the hole, or INVALID_COMP_ID
+	uint32_t swapRemove(uint32_t chunkIdx, uint32_t row)
+	{
+		auto& chunk = *chunks[chunkIdx];
+		auto& last = *chunks.back();
+		uint32_t lastRow = last.count - 1;
+
+		uint32_t moved = INVALID_COMP_ID;
+		for (size_t col = 0; col < types.size(); ++col)
+			types[col]->destroy(columnAt(chunk, col, row));
+
+		if (&chunk != &last || row != lastRow) {
+			for (size_t col = 0; col < types.size(); ++col) {
+				void* src = columnAt(last, col, lastRow);
+				types[col]->moveConstruct(columnAt(chunk, col, row), src);
+				types[col]->destroy(src);
+			}
+			moved = actorsOf(last)[lastRow];
+			actorsOf(chunk)[row] = moved;
+		}
+
+		--last.count;
+		--actorCount;
+		// chunks stay dense: only the last one is partial
+		if (last.count == 0) chunks.pop_back();
+		return moved;
+	}
+
+	size_t size() const { return actorCount; }
+
+public:
+	vector<const CompTypeInfo*> types;
+	vector<size_t> columnOffsets;
+	uint32_t chunkCapacity = 0;
+	vector<unique_ptr<ArchetypeChunk>> chunks;
+
+	// cached transitions, keyed by the component added/removed
+	unordered_map<CompTypeId, Archetype*> addEdges;
+	unordered_map<CompTypeId, Archetype*> removeEdges;
+
+private:
+	bool layoutColumns(uint32_t capacity)
+	{
+		columnOffsets.clear();
+		size_t offset = sizeof(uint32_t) * capacity;
+		for (auto* type : types) {
+			offset = (offset + type->align - 1) / type->align * type->align;
+			columnOffsets.push_back(offset);
+			offset += type->size * capacity;
+		}
+		return offset <= ArchetypeChunk::SIZE;
+	}
+
+	size_t actorCount = 0;
+};
+
+
+class ArchetypeECS {
+public:
+	ArchetypeECS()
+	{
+		root = getOrCreateArchetype({});
+	}
+
+	ActorManager actorManager{};
+
+public:
+	uint32_t createActor()
+	{
+		uint32_t id = actorManager.createActor();
+		if (Entity(id).is_null()) return id;
+
+		const uint32_t slot = Entity(id).index();
+		if (slot >= records.size()) records.resize(static_cast<size_t>(slot) + 1);
+
+		auto [chunk, row] = root->allocateRow(id);
+		records[slot] = { root, chunk, row };
+		return id;
+	}
+
+	void removeActor(uint32_t id)
+	{
+		if (!actorManager.isAlive(id)) {
+			cerr << "actor is not active" << '\n';
+			return;
+		}
+
+		auto& record = records[Entity(id).index()];
+		detach(record);
+		record = {};
+		actorManager.removeActor(id);
+	}
+
+	template<typename Comp_t>
+	void addComponent(const uint32_t id, const std::optional<Comp_t>& comp = std::nullopt)
+	{
+		if (!actorManager.isAlive(id)) {
+			cout << "actor is not active" << '\n';
+			return;
+		}
+
+		const auto& info = compTypeInfo<Comp_t>();
+		auto& record = records[Entity(id).index()];
+		if (record.archetype->hasType(info.id)) {
+			cout << "actor already has this component" << '\n';
+			return;
+		}
+
+		Archetype* dst = record.archetype->addEdges[info.id];
+		if (!dst) {
+			auto types = record.archetype->types;
+			types.insert(upper_bound(types.begin(), types.end(), &info,
+				[](auto* a, auto* b) { return a->id < b->id; }), &info);
+			dst = getOrCreateArchetype(std::move(types));
+			record.archetype->addEdges[info.id] = dst;
+			dst->removeEdges[info.id] = record.archetype;
+		}
+
+		moveActor(id, dst);
+		auto& chunk = *dst->chunks[record.chunk];
+		new (dst->columnAt(chunk, dst->columnIndex(info.id), record.row)) Comp_t(comp.value_or(Comp_t{}));
+	}
+
+	template<typename Comp_t>
+	void removeComponent(const uint32_t id)
+	{
+		if (!actorManager.isAlive(id)) {
+			cout << "actor is not active" << '\n';
+			return;
+		}
+
+		const auto& info = compTypeInfo<Comp_t>();
+		auto& record = records[Entity(id).index()];
+		if (!record.archetype->hasType(info.id)) {
+			cout << "actor does not have this component" << '\n';
+			return;
+		}
+
+		Archetype* dst = record.archetype->removeEdges[info.id];
+		if (!dst) {
+			auto types = record.archetype->types;
+			types.erase(find(types.begin(), types.end(), &info));
+			dst = getOrCreateArchetype(std::move(types));
+			record.archetype->removeEdges[info.id] = dst;
+			dst->addEdges[info.id] = record.archetype;
+		}
+
+		moveActor(id, dst);
+	}
+
+	template<typename Comp_t>
+	Comp_t* getComponent(const uint32_t id)
+	{
+		if (!actorManager.isAlive(id)) return nullptr;
+
+		auto& record = records[Entity(id).index()];
+		int col = record.archetype->columnIndex(compTypeInfo<Comp_t>().id);
+		if (col < 0) return nullptr;
+		return record.archetype->template column<Comp_t>(*record.archetype->chunks[record.chunk], col) + record.row;
+	}
+
+	template<typename Comp_t>
+	bool hasComponent(const uint32_t id) const
+	{
+		return actorManager.isAlive(id) && records[Entity(id).index()].archetype->hasType(compTypeInfo<Comp_t>().id);
+	}
+
+	/*
+	* fn(span<const uint32_t> actors, span<Comps>... columns), once per matching chunk;
+	* the columns are plain arrays, index them with the same row.
+	*/
+	template<typename... Comps, typename Func>
+	void forEachChunk(Func&& fn)
+	{
+		const CompTypeId ids[] = { compTypeInfo<Comps>().id... };
+
+		for (auto& [signature, archetype] : archetypes) {
+			if (archetype->size() == 0) continue;
+
+			int cols[sizeof...(Comps)];
+			bool bMatch = true;
+			for (size_t i = 0; i < sizeof...(Comps); ++i) {
+				cols[i] = archetype->columnIndex(ids[i]);
+				bMatch &= cols[i] >= 0;
+			}
+			if (!bMatch) continue;
+
+			for (auto& chunk : archetype->chunks) {
+				callChunk<Comps...>(*archetype, *chunk, cols, fn, index_sequence_for<Comps...>{});
+			}
+		}
+	}
+
+	// fn(uint32_t actor, Comps&... comps) per matching actor
+	template<typename... Comps, typename Func>
+	void each(Func&& fn)
+	{
+		forEachChunk<Comps...>([&](span<const uint32_t> actors, span<Comps>... columns) {
+			for (size_t row = 0; row < actors.size(); ++row)
+				fn(actors[row], columns[row]...);
+			});
+	}
+
+	size_t archetypeCount() const { return archetypes.size(); }
+
+private:
+	struct ActorRecord {
+		Archetype* archetype = nullptr;
+		uint32_t chunk = 0;
+		uint32_t row = 0;
+	};
+
+	Archetype* getOrCreateArchetype(vector<const CompTypeInfo*> types)
+	{
+		vector<CompTypeId> signature;
+		for (auto* type : types) signature.push_back(type->id);
+
+		if (auto it = archetypes.find(signature); it != archetypes.end()) return it->second.get();
+
+		// constructed before it is registered, so a rejected signature leaves nothing behind
+		auto archetype = make_unique<Archetype>(std::move(types));
+		return archetypes.emplace(std::move(signature), std::move(archetype)).first->second.get();
+	}
+
+	// move the shared columns into dst; columns dst lacks are destroyed with the old row.
+	// both signatures are sorted by id, so one pass pairs the columns up
+	void moveActor(uint32_t id, Archetype* dst)
+	{
+		auto& record = records[Entity(id).index()];
+		Archetype* src = record.archetype;
+		auto& srcChunk = *src->chunks[record.chunk];
+
+		auto [chunkIdx, row] = dst->allocateRow(id);
+		auto& dstChunk = *dst->chunks[chunkIdx];
+		size_t dstCol = 0;
+		for (size_t col = 0; col < src->types.size(); ++col) {
+			const CompTypeId typeId = src->types[col]->id;
+			while (dstCol < dst->types.size() && dst->types[dstCol]->id < typeId) ++dstCol;
+			if (dstCol == dst->types.size()) break;
+			if (dst->types[dstCol]->id != typeId) continue;
+			src->types[col]->moveConstruct(dst->columnAt(dstChunk, dstCol, row), src->columnAt(srcChunk, col, record.row));
+		}
+
+		detach(record);
+		record = { dst, chunkIdx, row };
+	}
+
+	void detach(const ActorRecord& record)
+	{
+		uint32_t moved = record.archetype->swapRemove(record.chunk, record.row);
+		if (moved != INVALID_COMP_ID) {
+			records[Entity(moved).index()].chunk = record.chunk;
+			records[Entity(moved).index()].row = record.row;
+		}
+	}
+
+	template<typename... Comps, typename Func, size_t... I>
+	static void callChunk(Archetype& archetype, ArchetypeChunk& chunk, const int* cols, Func& fn, index_sequence<I...>)
+	{
+		fn(span<const uint32_t>(archetype.actorsOf(chunk), chunk.count),
+			span<Comps>(archetype.template column<Comps>(chunk, cols[I]), chunk.count)...);
+	}
+
+private:
+	vector<ActorRecord> records;   // by Entity::index
+
+	// owned archetypes by signature
+	map<vector<CompTypeId>, unique_ptr<Archetype>> archetypes;
+	Archetype* root = nullptr;
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+
+/*
+* where component columns live.
+* every column (dense data, dense ids, ticks) goes through a std::pmr::memory_resource,
+* and always asks for at least cache-line alignment, so a column never shares its first line with a neighbour.
+* resources here:
+* - AlignedHeapResource: default, aligned operator new
+* - ArenaResource: per-world bump arena, frees nothing until the world goes; pair with reserve()
+* - HugePageResource: 2MB-granular OS pages with a free pool, for the few very large columns
+* none of them is thread safe, like structural changes on the ECS.
+*/
+
+inline constexpr size_t CACHE_LINE = 64;
+
+
+class AlignedHeapResource : public pmr::memory_resource {
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		return ::operator new(bytes, align_val_t(std::max(alignment, CACHE_LINE)));
+	}
+
+	void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+	{
+		::operator delete(ptr, bytes, align_val_t(std::max(alignment, CACHE_LINE)));
+	}
+
+	bool do_is_equal(const pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+inline pmr::memory_resource* defaultColumnResource()
+{
+	static AlignedHeapResource resource;
+	return &resource;
+}
+
+
+class ArenaResource : public pmr::memory_resource {
+public:
+	explicit ArenaResource(size_t blockSize = 1u << 20, pmr::memory_resource* upstream = defaultColumnResource())
+		: blockSize(blockSize), upstream(upstream) {}
+
+	~ArenaResource() override { release(); }
+
+	ArenaResource(const ArenaResource&) = delete;
+	ArenaResource& operator=(const ArenaResource&) = delete;
+
+	// frees every block; columns allocated from the arena must be gone
+	void release()
+	{
+		for (auto& block : blocks) upstream->deallocate(block.data, block.size, CACHE_LINE);
+		blocks.clear();
+		usedBytes = 0;
+	}
+
+	size_t reservedBytes() const
+	{
+		size_t total = 0;
+		for (auto& block : blocks) total += block.size;
+		return total;
+	}
+
+	size_t allocatedBytes() const { return usedBytes; }
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		alignment = std::max(alignment, CACHE_LINE);
+
+		if (!blocks.empty()) {
+			auto& block = blocks.back();
+			// the block itself is only cache line aligned, so it is the address that gets rounded, not the offset
+			const uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+			size_t offset = ((base + block.offset + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base;
+			if (offset + bytes <= block.size) {
+				block.offset = offset + bytes;
+				usedBytes += bytes;
+				return static_cast<std::byte*>(block.data) + offset;
+			}
+		}
+
+		size_t size = std::max(blockSize, bytes + alignment);
+		blocks.push_back({ upstream->allocate(size, CACHE_LINE), size, 0 });
+		return do_allocate(bytes, alignment);
+	}
+
+	// only the newest allocation is given back, the case of a vector growing as the last column
+	void do_deallocate(void* ptr, size_t bytes, size_t) override
+	{
+		usedBytes -= bytes;
+		if (blocks.empty()) return;
+		auto& block = blocks.back();
+		if (static_cast<std::byte*>(ptr) + bytes == static_cast<std::byte*>(block.data) + block.offset)
+			block.offset -= bytes;
+	}
+
+	bool do_is_equal(const pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+	struct Block {
+		void* data;
+		size_t size;
+		size_t offset;
+	};
+
+	size_t blockSize;
+	pmr::memory_resource* upstream;
+	vector<Block> blocks;
+	size_t usedBytes = 0;
+};
+
+
+class HugePageResource : public pmr::memory_resource {
+public:
+	static constexpr size_t HUGE_PAGE = 2u << 20;
+
+	HugePageResource() = default;
+	~HugePageResource() override
+	{
+		for (auto& [size, regions] : freeRegions)
+			for (void* region : regions) osFree(region, size);
+	}
+
+	HugePageResource(const HugePageResource&) = delete;
+	HugePageResource& operator=(const HugePageResource&) = delete;
+
+	size_t committedBytes() const { return committed; }
+
+protected:
+	void* do_allocate(size_t bytes, size_t) override
+	{
+		// OS pages are aligned far beyond a cache line
+		size_t size = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+
+		auto& pool = freeRegions[size];
+		if (!pool.empty()) {
+			void* region = pool.back();
+			pool.pop_back();
+			return region;
+		}
+
+		void* region = osAlloc(size);
+		if (!region) throw bad_alloc();
+		committed += size;
+		return region;
+	}
+
+	// kept for the next column of the same size, the OS gets it back with the resource
+	void do_deallocate(void* ptr, size_t bytes, size_t) override
+	{
+		size_t size = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+		freeRegions[size].push_back(ptr);
+	}
+
+	bool do_is_equal(const pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+	static void* osAlloc(size_t size)
+	{
+#ifdef _WIN32
+		// large pages need SeLockMemoryPrivilege, without it fall back to normal pages
+		const size_t largePage = GetLargePageMinimum();
+		if (largePage != 0 && size % largePage == 0) {
+			if (void* region = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE))
+				return region;
+		}
+		return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+		madvise(region, size, MADV_HUGEPAGE);
+#endif
+		return region;
+#endif
+	}
+
+	static void osFree(void* region, size_t size)
+	{
+#ifdef _WIN32
+		(void)size;
+		VirtualFree(region, 0, MEM_RELEASE);
+#else
+		munmap(region, size);
+#endif
+	}
+
+	map<size_t, vector<void*>> freeRegions;
+	size_t committed = 0;
+};
+
+
+// std allocator over a memory_resource, every column starts on a cache line
+template<typename T>
+class ColumnAllocator {
+public:
+	using value_type = T;
+
+	ColumnAllocator(pmr::memory_resource* resource = defaultColumnResource()) : resource(resource) {}
+
+	template<typename U>
+	ColumnAllocator(const ColumnAllocator<U>& other) : resource(other.resource) {}
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(resource->allocate(n * sizeof(T), std::max(alignof(T), CACHE_LINE)));
+	}
+
+	void deallocate(T* ptr, size_t n)
+	{
+		resource->deallocate(ptr, n * sizeof(T), std::max(alignof(T), CACHE_LINE));
+	}
+
+	template<typename U>
+	bool operator==(const ColumnAllocator<U>& other) const { return resource == other.resource; }
+
+	pmr::memory_resource* resource;
+};
+
+template<typename T>
+using ColumnVector = vector<T, ColumnAllocator<T>>;
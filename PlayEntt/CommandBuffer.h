@@ -0,0 +1,188 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <cassert>
+
+#include "ECS.h"
+
+using namespace std;
+
+
+/*
+* deferred structural changes:
+* systems record create/destroy/add/remove instead of touching the sets,
+* the commands are applied at a sync point, when nothing iterates.
+* so spans and views stay valid while systems run, and spawning can happen from any thread.
+*/
+
+class CommandBuffer;
+
+// an actor created by a command buffer, it gets a real id only when the buffer is applied.
+// it only means something to the buffer that made it, and only until that buffer is applied
+struct PendingActor {
+	const CommandBuffer* owner;
+	uint32_t epoch;
+	uint32_t local;
+};
+
+
+class CommandBuffer {
+public:
+	PendingActor createActor()
+	{
+		const uint32_t local = numCreated++;
+		commands.push_back([](ECS& ecs, vector<uint32_t>& created) {
+			created.push_back(ecs.createActor());
+			});
+		return { this, epoch, local };
+	}
+
+	void removeActor(const uint32_t id)
+	{
+		commands.push_back([id](ECS& ecs, vector<uint32_t>&) {
+			// destroyed twice, or by another buffer
+			if (ecs.actorManager.isAlive(id)) ecs.removeActor(id);
+			});
+	}
+
+	void removeActor(const PendingActor actor)
+	{
+		checkOwned(actor);
+		commands.push_back([actor](ECS& ecs, vector<uint32_t>& created) {
+			if (ecs.actorManager.isAlive(created[actor.local])) ecs.removeActor(created[actor.local]);
+			});
+	}
+
+	// adds, or overwrites the component the actor already has
+	template<typename Comp_t>
+	void addComponent(const uint32_t id, Comp_t comp = {})
+	{
+		commands.push_back([id, comp = std::move(comp)](ECS& ecs, vector<uint32_t>&) mutable {
+			emplaceOrReplace(ecs, id, std::move(comp));
+			});
+	}
+
+	template<typename Comp_t>
+	void addComponent(const PendingActor actor, Comp_t comp = {})
+	{
+		checkOwned(actor);
+		commands.push_back([actor, comp = std::move(comp)](ECS& ecs, vector<uint32_t>& created) mutable {
+			emplaceOrReplace(ecs, created[actor.local], std::move(comp));
+			});
+	}
+
+	template<typename Comp_t>
+	void removeComponent(const uint32_t id)
+	{
+		commands.push_back([id](ECS& ecs, vector<uint32_t>&) {
+			if (ecs.hasComponent<Comp_t>(id)) ecs.removeComponent<Comp_t>(id);
+			});
+	}
+
+	template<typename Comp_t>
+	void removeComponent(const PendingActor actor)
+	{
+		checkOwned(actor);
+		commands.push_back([actor](ECS& ecs, vector<uint32_t>& created) {
+			if (ecs.hasComponent<Comp_t>(created[actor.local])) ecs.removeComponent<Comp_t>(created[actor.local]);
+			});
+	}
+
+	// in recording order; returns the ids given to the pending actors, by PendingActor::local
+	vector<uint32_t> apply(ECS& ecs)
+	{
+		vector<uint32_t> created;
+		created.reserve(numCreated);
+		for (auto& command : commands) command(ecs, created);
+
+		commands.clear();
+		numCreated = 0;
+		++epoch;
+		return created;
+	}
+
+	bool empty() const { return commands.empty(); }
+	size_t size() const { return commands.size(); }
+
+private:
+	// created[] is per buffer and per apply, a foreign or stale pending actor would index someone else's actor
+	void checkOwned([[maybe_unused]] const PendingActor actor) const
+	{
+		assert(actor.owner == this && "pending actor recorded into a buffer that did not create it");
+		assert(actor.epoch == epoch && "pending actor used after its buffer was applied");
+	}
+
+	// a replace goes through patch() so changed() sees it, like any other write
+	template<typename Comp_t>
+	static void emplaceOrReplace(ECS& ecs, const uint32_t id, Comp_t&& comp)
+	{
+		if (!ecs.actorManager.isAlive(id)) return;
+		if (ecs.hasComponent<Comp_t>(id)) *ecs.patch<Comp_t>(id) = std::move(comp);
+		else ecs.addComponent<Comp_t>(id, std::move(comp));
+	}
+
+private:
+	vector<function<void(ECS&, vector<uint32_t>&)>> commands;
+	uint32_t numCreated = 0;
+	uint32_t epoch = 0;
+};
+
+
+/*
+* one CommandBuffer per recording thread, so recording takes no lock after the first use.
+* apply() replays the buffers in the order the threads first recorded;
+* commands of one thread keep their order, commands across threads have no defined order.
+*/
+class CommandQueue {
+public:
+	CommandQueue() : serial(nextSerial()) {}
+
+	CommandQueue(const CommandQueue&) = delete;
+	CommandQueue& operator=(const CommandQueue&) = delete;
+
+	// the calling thread's buffer
+	CommandBuffer& local()
+	{
+		// cache keyed by queue serial, serials are never reused so stale entries are never hit
+		thread_local vector<pair<uint64_t, CommandBuffer*>> tl_buffers;
+		for (auto& [owner, buffer] : tl_buffers)
+			if (owner == serial) return *buffer;
+
+		lock_guard<mutex> lock(buffersMutex);
+		buffers.push_back(make_unique<CommandBuffer>());
+		tl_buffers.push_back({ serial, buffers.back().get() });
+		return *buffers.back();
+	}
+
+	// sync point: no thread may record while this runs
+	void apply(ECS& ecs)
+	{
+		lock_guard<mutex> lock(buffersMutex);
+		for (auto& buffer : buffers)
+			if (!buffer->empty()) buffer->apply(ecs);
+	}
+
+	bool empty()
+	{
+		lock_guard<mutex> lock(buffersMutex);
+		for (auto& buffer : buffers)
+			if (!buffer->empty()) return false;
+		return true;
+	}
+
+private:
+	static uint64_t nextSerial()
+	{
+		static atomic<uint64_t> counter{ 1 };
+		return counter.fetch_add(1, memory_order_relaxed);
+	}
+
+	const uint64_t serial;
+	mutex buffersMutex;
+	vector<unique_ptr<CommandBuffer>> buffers;
+};
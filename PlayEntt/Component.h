@@ -4,6 +4,12 @@
 #include <iostream> 
 #include <concepts>
 #include <limits>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+
+#include "Actor.h"
+#include "ColumnAllocator.h"
 
 
 /*
@@ -12,12 +18,6 @@
 
 */
 
-namespace Config {
-
-	inline constexpr uint32_t MAX_ACTORS = 100;
-}
-using namespace Config;
-
 using namespace std;
 
 
@@ -27,24 +27,49 @@ constexpr uint32_t INVALID_COMP_ID = std::numeric_limits<uint32_t>::max();
 
 
 // Base class for all component storages
+struct CompMemoryStats {
+	size_t count = 0;
+	size_t capacity = 0;
+	size_t denseBytes = 0;    // capacity of every dense column
+	size_t sparseBytes = 0;   // allocated pages
+};
+
 class CompStorageBase {
 public:
 	virtual ~CompStorageBase() = default;
 	virtual void removeComponent(uint32_t id) = 0; 
+	virtual bool contains(uint32_t id) const = 0;
+	virtual void reserve(size_t count) = 0;
+	virtual CompMemoryStats memoryStats() const = 0;
 };
 
+/*
+* sparse side is paged: a page of PAGE_SIZE slots is allocated the first time an actor index lands in it,
+* so a type used by a handful of actors costs a page or two, not one slot per possible actor.
+* actor ids are generational (see Entity), pages are indexed by Entity::index;
+* the dense side stores the full id, so a stale handle with a reused index does not match.
+* each dense entry also carries the world tick it was added and last changed at, see ECS::changed,
+* and every TICK_BLOCK entries share the newest of those ticks, so a change query skips the untouched blocks.
+*/
 template<typename Comp_t>
-class CompAllocator:  public CompStorageBase  {
+class CompAllocator final :  public CompStorageBase  {
 public:  
+	static constexpr uint32_t PAGE_BITS = 12;
+	static constexpr uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+	static constexpr uint32_t PAGE_MASK = PAGE_SIZE - 1;
+	static constexpr uint32_t TICK_BLOCK_BITS = 6;
+	static constexpr uint32_t TICK_BLOCK = 1u << TICK_BLOCK_BITS;
+
 	~CompAllocator() = default;
-	CompAllocator() {
-		actorToComp = vector<uint32_t>(MAX_ACTORS, INVALID_COMP_ID);
-		compToActor.reserve(MAX_ACTORS);   
-	}
 
-	void addComponent(const uint32_t id, const Comp_t& comp) 
+	// all dense columns come from the resource, see ColumnAllocator.h
+	explicit CompAllocator(pmr::memory_resource* resource = defaultColumnResource())
+		: compToActor(resource), denseData(resource), addedTicks(resource), changedTicks(resource),
+		blockAddedTicks(resource), blockChangedTicks(resource) {}
+
+	void addComponent(const uint32_t id, const Comp_t& comp, const uint32_t tick = 0) 
 	{
-		if (actorToComp[id] != INVALID_COMP_ID)
+		if (contains(id))
 		{
 			cout << "actor already has this component" << '\n';
 			return;
@@ -52,29 +77,53 @@ public:
 		else
 		{
 			denseData.push_back(comp);
-			actorToComp[id] = static_cast<uint32_t>(denseData.size() - 1);
+			sparseSlot(id) = static_cast<uint32_t>(denseData.size() - 1);
 			compToActor.push_back(id);
+			addedTicks.push_back(tick);
+			changedTicks.push_back(tick);
+
+			const uint32_t dense = static_cast<uint32_t>(denseData.size() - 1);
+			if ((dense & (TICK_BLOCK - 1)) == 0) {
+				blockAddedTicks.push_back(tick);
+				blockChangedTicks.push_back(tick);
+			}
+			else {
+				raiseBlockTick(blockAddedTicks, dense, tick);
+				raiseBlockTick(blockChangedTicks, dense, tick);
+			}
 		}
 	}
 
 	virtual void removeComponent(uint32_t id) override
 	{
-		if (actorToComp[id] != INVALID_COMP_ID)
+		if (contains(id))
 		{
-			uint32_t compToRemoveId = actorToComp[id]; 
+			uint32_t compToRemoveId = index(id); 
 			//cout << "to remove: " << compToRemoveId << '\n';
 
 			//swap with last element
 			uint32_t lastCompId = static_cast<uint32_t>(denseData.size()) - 1;
 			swap(denseData[compToRemoveId], denseData[lastCompId]);
 			swap(compToActor[compToRemoveId], compToActor[lastCompId]);
+			swap(addedTicks[compToRemoveId], addedTicks[lastCompId]);
+			swap(changedTicks[compToRemoveId], changedTicks[lastCompId]);
+
+			//the moved actor now lives in the hole, and so do its ticks
+			sparseSlot(compToActor[compToRemoveId]) = compToRemoveId;
+			raiseBlockTick(blockAddedTicks, compToRemoveId, addedTicks[compToRemoveId]);
+			raiseBlockTick(blockChangedTicks, compToRemoveId, changedTicks[compToRemoveId]);
 
 			//delete last element
 			denseData.pop_back();
 			compToActor.pop_back();
-
-			//set actorToComp to 0
-			actorToComp[id] = INVALID_COMP_ID;
+			addedTicks.pop_back();
+			changedTicks.pop_back();
+			if ((lastCompId & (TICK_BLOCK - 1)) == 0) {
+				blockAddedTicks.pop_back();
+				blockChangedTicks.pop_back();
+			}
+
+			sparseSlot(id) = INVALID_COMP_ID;
 		}
 		else
 		{
@@ -82,9 +131,87 @@ public:
 		}
 	}
 
-	vector<uint32_t> actorToComp; //or sparseList
-	vector<uint32_t> compToActor;  //or denseList  
-	vector<Comp_t> denseData;
+	// dense index of the actor's component, INVALID_COMP_ID if it has none
+	uint32_t index(const uint32_t id) const
+	{
+		const uint32_t slot = Entity(id).index();
+		const uint32_t page = slot >> PAGE_BITS;
+		if (page >= actorToComp.size() || !actorToComp[page]) return INVALID_COMP_ID;
+
+		const uint32_t dense = actorToComp[page][slot & PAGE_MASK];
+		return (dense != INVALID_COMP_ID && compToActor[dense] == id) ? dense : INVALID_COMP_ID;
+	}
+
+	virtual bool contains(const uint32_t id) const override { return index(id) != INVALID_COMP_ID; }
+
+	size_t size() const { return denseData.size(); }
+
+	// a write through ECS::patch; entities of one set may be patched from several threads at once
+	void stampChanged(const uint32_t dense, const uint32_t tick)
+	{
+		changedTicks[dense] = tick;
+		raiseBlockTick(blockChangedTicks, dense, tick);
+	}
+
+	// grow once up front instead of doubling mid-level
+	virtual void reserve(size_t count) override
+	{
+		compToActor.reserve(count);
+		denseData.reserve(count);
+		addedTicks.reserve(count);
+		changedTicks.reserve(count);
+		blockAddedTicks.reserve(count / TICK_BLOCK + 1);
+		blockChangedTicks.reserve(count / TICK_BLOCK + 1);
+	}
+
+	virtual CompMemoryStats memoryStats() const override
+	{
+		CompMemoryStats stats;
+		stats.count = denseData.size();
+		stats.capacity = denseData.capacity();
+		stats.denseBytes = denseData.capacity() * sizeof(Comp_t)
+			+ (compToActor.capacity() + addedTicks.capacity() + changedTicks.capacity()
+				+ blockAddedTicks.capacity() + blockChangedTicks.capacity()) * sizeof(uint32_t);
+		stats.sparseBytes = pageCount() * PAGE_SIZE * sizeof(uint32_t) + actorToComp.capacity() * sizeof(void*);
+		return stats;
+	}
+
+	size_t pageCount() const
+	{
+		size_t count = 0;
+		for (auto& page : actorToComp) count += page != nullptr;
+		return count;
+	}
+
+	vector<unique_ptr<uint32_t[]>> actorToComp; //or sparseList, paged
+	ColumnVector<uint32_t> compToActor;  //or denseList  
+	ColumnVector<Comp_t> denseData;
+	ColumnVector<uint32_t> addedTicks;    // parallel to denseData
+	ColumnVector<uint32_t> changedTicks;
+	ColumnVector<uint32_t> blockAddedTicks;    // newest tick of each TICK_BLOCK dense entries, an upper bound
+	ColumnVector<uint32_t> blockChangedTicks;
+
+private:
+	// only ever moves forward (wrap-safe), concurrent patches of one block race to the newest tick
+	static void raiseBlockTick(ColumnVector<uint32_t>& blockTicks, const uint32_t dense, const uint32_t tick)
+	{
+		atomic_ref<uint32_t> block(blockTicks[dense >> TICK_BLOCK_BITS]);
+		uint32_t current = block.load(memory_order_relaxed);
+		while (static_cast<int32_t>(tick - current) > 0
+			&& !block.compare_exchange_weak(current, tick, memory_order_relaxed)) {}
+	}
+
+	uint32_t& sparseSlot(const uint32_t id)
+	{
+		const uint32_t slot = Entity(id).index();
+		const uint32_t page = slot >> PAGE_BITS;
+		if (page >= actorToComp.size()) actorToComp.resize(page + 1);
+		if (!actorToComp[page]) {
+			actorToComp[page] = make_unique<uint32_t[]>(PAGE_SIZE);
+			fill_n(actorToComp[page].get(), PAGE_SIZE, INVALID_COMP_ID);
+		}
+		return actorToComp[page][slot & PAGE_MASK];
+	}
 
 };
  
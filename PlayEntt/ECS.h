@@ -8,6 +8,9 @@
 #include <optional>
 #include <span>
 #include <tuple>
+#include <type_traits>
+#include <algorithm>
+#include <atomic>
 
 #include "Component.h"
 
@@ -22,53 +25,237 @@ using namespace std;
 
  
 
+/*
+* actor ids are generational Entity ids: 24-bit slot index + 8-bit version.
+* a slot's version is bumped when its actor is removed, so old handles fail isAlive.
+* slots are added on demand; freed slots are reused first, newest first.
+*/
 class ActorManager
 {
 public:
-	vector<bool> sparseList;
-	vector<uint32_t> freeList;  
+	vector<bool> sparseList;       // alive flag per slot
+	vector<uint32_t> versions;     // current version per slot
+	vector<uint32_t> freeList;     // freed slots only, never prefilled
 
-	ActorManager()
-	{
-		sparseList = vector<bool>(MAX_ACTORS, false);
-
-		freeList.reserve(MAX_ACTORS);  
-		for (uint32_t i = 0; i < MAX_ACTORS; i++)
-		{
-			freeList.push_back(MAX_ACTORS - i - 1);
-		} 
-	}
+	ActorManager() = default;
 
 	uint32_t createActor()
 	{
-		uint32_t id{};
+		uint32_t index{};
 		if (freeList.size() > 0)
 		{
-			id = freeList.back();
+			index = freeList.back();
 			freeList.pop_back();
-
-			sparseList[id] = true;
 		}
 		else
 		{
-			cout << "run out of object pool" << '\n';
+			index = static_cast<uint32_t>(versions.size());
+			// the last index with the last version is the null id
+			if (index >= Entity::index_mask) {
+				cout << "run out of actor ids" << '\n';
+				return Entity::null_id;
+			}
+			versions.push_back(0);
+			sparseList.push_back(false);
 		}
-		return id;
+
+		sparseList[index] = true;
+		return Entity::create(index, versions[index]).raw_id();
 	}
 
 
 	void removeActor(uint32_t id)
 	{
-		freeList.push_back(id);  
-		sparseList[id] = false;
+		const uint32_t index = Entity(id).index();
+		sparseList[index] = false;
+		versions[index] = (versions[index] + 1) & Entity::version_mask;
+		freeList.push_back(index);
 	}
 
-	bool isAlive(uint32_t id) { return sparseList[id]; }
+	bool isAlive(uint32_t id) const
+	{
+		const Entity actor(id);
+		return !actor.is_null() && actor.index() < sparseList.size()
+			&& sparseList[actor.index()] && versions[actor.index()] == actor.version();
+	}
+
+	size_t aliveCount() const { return versions.size() - freeList.size(); }
 	 
 };
 
  
 
+/*
+* view<A, B>(exclude<C>): actors that have A and B but not C.
+* iteration walks the dense list of the smallest included set,
+* the other sets are probed through actorToComp, so each step is a few array reads.
+*/
+template<typename... Comps>
+struct Exclude {};
+
+template<typename... Comps>
+inline constexpr Exclude<Comps...> exclude{};
+
+
+template<typename Excludes, typename... Comps>
+class View;
+
+template<typename... Excludes, typename... Comps>
+class View<Exclude<Excludes...>, Comps...> {
+	static_assert(sizeof...(Comps) > 0, "view needs at least one component");
+
+public:
+	View(CompAllocator<Comps>*... sets, CompAllocator<Excludes>*... excludedSets)
+		: sets(sets...), excludedSets(excludedSets...)
+	{
+		bValid = ((sets != nullptr) && ...);
+	}
+
+	// fn(uint32_t actor, Comps&...) or fn(Comps&...)
+	template<typename Func>
+	void each(Func&& fn) const
+	{
+		each(0, sizeHint(), fn);
+	}
+
+	/*
+	* only the driver positions [begin, end), for splitting one view across threads;
+	* chunks of the same view pick the same driver as long as no set changes size in between.
+	*/
+	template<typename Func>
+	void each(size_t begin, size_t end, Func&& fn) const
+	{
+		if (!bValid) return;
+
+		// dispatch on the smallest set once, the loop itself is typed
+		const size_t driver = driverIndex();
+		size_t k = 0;
+		((k++ == driver ? eachDrivenBy<Comps>(fn, begin, end) : void()), ...);
+	}
+
+	bool contains(const uint32_t id) const
+	{
+		if (!bValid) return false;
+		return (std::get<CompAllocator<Comps>*>(sets)->contains(id) && ...) && !isExcluded(id);
+	}
+
+	template<typename Comp_t>
+	Comp_t& get(const uint32_t id) const
+	{
+		auto* set = std::get<CompAllocator<Comp_t>*>(sets);
+		return set->denseData[set->index(id)];
+	}
+
+	// upper bound of the actors visited
+	size_t sizeHint() const
+	{
+		if (!bValid) return 0;
+		return std::min({ std::get<CompAllocator<Comps>*>(sets)->size()... });
+	}
+
+private:
+	bool isExcluded(const uint32_t id) const
+	{
+		return ((std::get<CompAllocator<Excludes>*>(excludedSets) && std::get<CompAllocator<Excludes>*>(excludedSets)->contains(id)) || ...);
+	}
+
+	size_t driverIndex() const
+	{
+		const size_t sizes[] = { std::get<CompAllocator<Comps>*>(sets)->size()... };
+		return std::min_element(std::begin(sizes), std::end(sizes)) - std::begin(sizes);
+	}
+
+	template<typename Driver, typename Func>
+	void eachDrivenBy(Func& fn, size_t begin, size_t end) const
+	{
+		auto* driver = std::get<CompAllocator<Driver>*>(sets);
+		const uint32_t* actors = driver->compToActor.data();
+		const size_t count = std::min(end, driver->compToActor.size());
+
+		for (size_t i = begin; i < count; ++i) {
+			const uint32_t actor = actors[i];
+
+			uint32_t indices[] = { (is_same_v<Comps, Driver> ? static_cast<uint32_t>(i)
+				: std::get<CompAllocator<Comps>*>(sets)->index(actor))... };
+
+			bool bMatch = true;
+			for (uint32_t idx : indices) bMatch &= idx != INVALID_COMP_ID;
+			if (!bMatch) continue;
+			if constexpr (sizeof...(Excludes) > 0) {
+				if (isExcluded(actor)) continue;
+			}
+
+			invoke(fn, actor, indices, index_sequence_for<Comps...>{});
+		}
+	}
+
+	template<typename Func, size_t... I>
+	void invoke(Func& fn, const uint32_t actor, const uint32_t* indices, index_sequence<I...>) const
+	{
+		if constexpr (is_invocable_v<Func&, uint32_t, Comps&...>)
+			fn(actor, std::get<I>(sets)->denseData[indices[I]]...);
+		else
+			fn(std::get<I>(sets)->denseData[indices[I]]...);
+	}
+
+private:
+	tuple<CompAllocator<Comps>*...> sets;
+	tuple<CompAllocator<Excludes>*...> excludedSets;
+	bool bValid = false;
+};
+
+
+
+/*
+* change detection: the world keeps a tick, every add stamps added/changed,
+* every write through patch() stamps changed; changed<T>(since) visits only entries stamped after since.
+* only patch() marks a change: writes through getComponent(), views or each() are not seen.
+* the scheduler bumps the tick per system run and passes each system the tick it last ran at.
+* the storage keeps the newest tick per block of entries, blocks older than since are skipped whole,
+* so a query costs one compare per CompAllocator::TICK_BLOCK entries plus the blocks that did change.
+*/
+template<typename Comp_t>
+class ChangedView {
+public:
+	ChangedView(CompAllocator<Comp_t>* set, const uint32_t sinceTick, const bool bAddedOnly)
+		: set(set), sinceTick(sinceTick), bAddedOnly(bAddedOnly) {}
+
+	// fn(uint32_t actor, Comp_t&) or fn(Comp_t&)
+	template<typename Func>
+	void each(Func&& fn) const
+	{
+		if (!set) return;
+
+		const uint32_t* ticks = bAddedOnly ? set->addedTicks.data() : set->changedTicks.data();
+		const uint32_t* blockTicks = bAddedOnly ? set->blockAddedTicks.data() : set->blockChangedTicks.data();
+		const size_t count = set->size();
+		for (size_t block = 0; block * CompAllocator<Comp_t>::TICK_BLOCK < count; ++block) {
+			if (!newer(blockTicks[block])) continue;
+
+			const size_t begin = block * CompAllocator<Comp_t>::TICK_BLOCK;
+			const size_t end = std::min(count, begin + CompAllocator<Comp_t>::TICK_BLOCK);
+			for (size_t i = begin; i < end; ++i) {
+				if (!newer(ticks[i])) continue;
+
+				if constexpr (is_invocable_v<Func&, uint32_t, Comp_t&>)
+					fn(set->compToActor[i], set->denseData[i]);
+				else
+					fn(set->denseData[i]);
+			}
+		}
+	}
+
+private:
+	// wrap-safe "stamped after since"
+	bool newer(const uint32_t tick) const { return static_cast<int32_t>(tick - sinceTick) > 0; }
+
+	CompAllocator<Comp_t>* set;
+	uint32_t sinceTick;
+	bool bAddedOnly;
+};
+
+
+
 class ECS { 
 public:
 	~ECS() = default;
@@ -76,6 +263,12 @@ public:
 
 	ActorManager actorManager{};
 
+	// change detection clock, see ChangedView
+	atomic<uint32_t> changeTick{ 1 };
+
+	// columns of types registered from now on, eg. a per-world ArenaResource; must outlive the ECS
+	pmr::memory_resource* columnResource = defaultColumnResource();
+
 	// shared ptr will capture the correct destructor; 
 	unordered_map<type_index, shared_ptr<CompStorageBase>> componentAllocators;
 
@@ -87,14 +280,54 @@ public:
 	}
 
  template <typename Comp_t> 
-	void registerComponent() {
+	void registerComponent(pmr::memory_resource* resource = nullptr) {
 		auto typeIdx = type_index(typeid(Comp_t));
 
 	   if (componentAllocators.contains(typeIdx)) {
 		 cerr << "component type already registered!" << '\n';
 		 return;
 	   }
-	    componentAllocators[typeIdx] = make_shared<CompAllocator<Comp_t>>();
+	    componentAllocators[typeIdx] = make_shared<CompAllocator<Comp_t>>(resource ? resource : columnResource);
+	}
+
+	template<typename Comp_t>
+	void reserve(const size_t count)
+	{
+		if (auto* sparseSet = getAllocator<Comp_t>()) sparseSet->reserve(count);
+		else cerr << "component type not registered!" << '\n';
+	}
+
+	void reserveActors(const size_t count)
+	{
+		actorManager.sparseList.reserve(count);
+		actorManager.versions.reserve(count);
+	}
+
+	struct TypeMemoryReport {
+		string name;
+		CompMemoryStats stats;
+	};
+
+	vector<TypeMemoryReport> memoryReport() const
+	{
+		vector<TypeMemoryReport> report;
+		for (auto& [type, allocator] : componentAllocators)
+			report.push_back({ type.name(), allocator->memoryStats() });
+		sort(report.begin(), report.end(), [](auto& a, auto& b) {
+			return a.stats.denseBytes + a.stats.sparseBytes > b.stats.denseBytes + b.stats.sparseBytes;
+			});
+		return report;
+	}
+
+	void printMemoryReport() const
+	{
+		size_t total = 0;
+		for (auto& [name, stats] : memoryReport()) {
+			cout << name << ": " << stats.count << " / " << stats.capacity
+				<< ", dense " << stats.denseBytes / 1024 << " KB, sparse " << stats.sparseBytes / 1024 << " KB" << '\n';
+			total += stats.denseBytes + stats.sparseBytes;
+		}
+		cout << "total: " << total / 1024 << " KB" << '\n';
 	}
 
 	template<typename Comp_t> 
@@ -109,7 +342,7 @@ public:
 
             auto allocator = componentAllocators[typeid(Comp_t)].get();
             auto sparseSet = static_cast<CompAllocator<Comp_t>*>(allocator);
-            sparseSet->addComponent(id, comp.value_or(Comp_t{})); 
+            sparseSet->addComponent(id, comp.value_or(Comp_t{}), currentTick()); 
         }
 		else
 		{
@@ -132,11 +365,86 @@ public:
 		// delete all components  
 		for (auto& [type, allocator] : componentAllocators)
 		{ 
-			allocator->removeComponent(id);
+			if (allocator->contains(id)) allocator->removeComponent(id);
 		}
 
 	} 
+
+	template<typename Comp_t>
+	void removeComponent(const uint32_t id)
+	{
+		if (!actorManager.isAlive(id)) {
+			cout << "actor is not active" << '\n';
+			return;
+		}
+
+		if (auto* sparseSet = getAllocator<Comp_t>()) sparseSet->removeComponent(id);
+		else cerr << "component type not registered!" << '\n';
+	}
+
+	template<typename Comp_t>
+	bool hasComponent(const uint32_t id)
+	{
+		auto* sparseSet = getAllocator<Comp_t>();
+		return sparseSet && actorManager.isAlive(id) && sparseSet->contains(id);
+	}
+
+	template<typename Comp_t>
+	Comp_t* getComponent(const uint32_t id)
+	{
+		if (!hasComponent<Comp_t>(id)) return nullptr;
+		auto* sparseSet = getAllocator<Comp_t>();
+		return &sparseSet->denseData[sparseSet->index(id)];
+	}
 	
+	uint32_t currentTick() const { return changeTick.load(memory_order_relaxed); }
+
+	// returns the new tick
+	uint32_t incrementTick() { return changeTick.fetch_add(1, memory_order_relaxed) + 1; }
+
+	// mutable access that counts as a change, the only one: getComponent() writes are not seen by changed()
+	template<typename Comp_t>
+	Comp_t* patch(const uint32_t id)
+	{
+		if (!hasComponent<Comp_t>(id)) return nullptr;
+		auto* sparseSet = getAllocator<Comp_t>();
+		const uint32_t dense = sparseSet->index(id);
+		sparseSet->stampChanged(dense, currentTick());
+		return &sparseSet->denseData[dense];
+	}
+
+	// components added or patched after sinceTick
+	template<typename Comp_t>
+	ChangedView<Comp_t> changed(const uint32_t sinceTick)
+	{
+		return ChangedView<Comp_t>(getAllocator<Comp_t>(), sinceTick, false);
+	}
+
+	// components added after sinceTick
+	template<typename Comp_t>
+	ChangedView<Comp_t> added(const uint32_t sinceTick)
+	{
+		return ChangedView<Comp_t>(getAllocator<Comp_t>(), sinceTick, true);
+	}
+
+	template<typename Comp_t>
+	CompAllocator<Comp_t>* getAllocator()
+	{
+		auto it = componentAllocators.find(typeid(Comp_t));
+		if (it == componentAllocators.end()) return nullptr;
+		return static_cast<CompAllocator<Comp_t>*>(it->second.get());
+	}
+
+	// ecs.view<Pos, Vel>().each(...), ecs.view<Pos>(exclude<Static>).each(...)
+	template<typename... Comps, typename... Excludes>
+	View<Exclude<Excludes...>, Comps...> view(Exclude<Excludes...> = {})
+	{
+		if (((getAllocator<Comps>() == nullptr) || ...)) {
+			cerr << "component not registered!" << '\n';
+		}
+		return View<Exclude<Excludes...>, Comps...>(getAllocator<Comps>()..., getAllocator<Excludes>()...);
+	}
+
 	template<typename Comp_t> 
 	std::tuple<span<uint32_t>,span<Comp_t>> getComponentViews()
 	{
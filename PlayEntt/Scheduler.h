@@ -0,0 +1,374 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+#include <typeindex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "ECS.h"
+#include "CommandBuffer.h"
+
+using namespace std;
+
+
+/*
+* systems declare what they read and write:
+*   scheduler.addSystem("movement", Read<Vel>{}, Write<Pos>{}, [](SystemContext& ctx) {...});
+* two systems conflict when one writes a component the other reads or writes;
+* conflicting systems keep their registration order, everything else may run at the same time.
+* structural changes go through ctx.commands(), applied at the next sync point:
+* after every stage (see addSyncPoint) and at the end of run().
+*/
+template<typename... Comps>
+struct Read {};
+
+template<typename... Comps>
+struct Write {};
+
+
+// minimal pool, a waiting thread runs queued tasks instead of blocking
+class TaskPool {
+public:
+	explicit TaskPool(uint32_t numThreads = defaultThreadCount())
+	{
+		for (uint32_t i = 0; i < numThreads; ++i)
+			workers.emplace_back([this] { workerLoop(); });
+	}
+
+	~TaskPool()
+	{
+		{
+			lock_guard<mutex> lock(queueMutex);
+			bExit = true;
+		}
+		queueCV.notify_all();
+		for (auto& worker : workers) worker.join();
+	}
+
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	static uint32_t defaultThreadCount()
+	{
+		uint32_t hw = thread::hardware_concurrency();
+		return hw > 1 ? hw - 1 : 1;
+	}
+
+	uint32_t threadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+	void submit(function<void()> task)
+	{
+		{
+			lock_guard<mutex> lock(queueMutex);
+			tasks.push_back(std::move(task));
+		}
+		queueCV.notify_one();
+	}
+
+	// blocks until pending is 0, running queued tasks meanwhile; tasks may therefore wait too (nested systems)
+	void waitFor(const atomic<int>& pending)
+	{
+		while (pending.load(memory_order_acquire) > 0) {
+			unique_lock<mutex> lock(queueMutex);
+			queueCV.wait(lock, [&] { return !tasks.empty() || pending.load(memory_order_acquire) <= 0; });
+			if (tasks.empty()) break;
+
+			auto task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			task();
+		}
+	}
+
+	// after the decrement that brought a waited counter to 0; the empty lock orders it against a waiter about to sleep
+	void wakeWaiters()
+	{
+		{ lock_guard<mutex> lock(queueMutex); }
+		queueCV.notify_all();
+	}
+
+	/*
+	* fn(begin, end) over [0, count): ranges of grainSize are claimed from a shared cursor,
+	* by the caller and by at most one helper task per worker, so a slow range does not hold up a fixed split.
+	* grainSize is also the cost of one atomic claim, keep it well above 1 for cheap bodies.
+	*/
+	template<typename Func>
+	void parallelFor(size_t count, size_t grainSize, Func&& fn)
+	{
+		if (count == 0) return;
+		grainSize = std::max<size_t>(1, grainSize);
+
+		const size_t numRanges = (count + grainSize - 1) / grainSize;
+		const int numHelpers = static_cast<int>(std::min<size_t>(numRanges - 1, workers.size()));
+		if (numHelpers == 0) {
+			fn(size_t(0), count);
+			return;
+		}
+
+		atomic<size_t> cursor{ 0 };
+		auto claimRanges = [&] {
+			for (size_t begin = cursor.fetch_add(grainSize, memory_order_relaxed); begin < count;
+				begin = cursor.fetch_add(grainSize, memory_order_relaxed))
+				fn(begin, std::min(count, begin + grainSize));
+		};
+
+		atomic<int> helpersLeft{ numHelpers };
+		for (int i = 0; i < numHelpers; ++i) {
+			submit([&] {
+				claimRanges();
+				if (helpersLeft.fetch_sub(1, memory_order_acq_rel) == 1) wakeWaiters();
+				});
+		}
+		claimRanges();
+		waitFor(helpersLeft);
+	}
+
+private:
+	void workerLoop()
+	{
+		while (true) {
+			unique_lock<mutex> lock(queueMutex);
+			queueCV.wait(lock, [&] { return bExit || !tasks.empty(); });
+			if (tasks.empty()) return;
+
+			auto task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			task();
+		}
+	}
+
+private:
+	vector<thread> workers;
+	deque<function<void()>> tasks;
+	mutex queueMutex;
+	condition_variable queueCV;
+	bool bExit = false;
+};
+
+
+class SystemContext;
+
+struct SystemDesc {
+	string name;
+	vector<type_index> reads;
+	vector<type_index> writes;
+	function<void(SystemContext&)> fn;
+
+	uint32_t stage = 0;
+	uint32_t lastRunTick = 0;   // world tick the previous run ended on
+
+	// built by the scheduler
+	vector<uint32_t> successors;
+	uint32_t numDeps = 0;
+};
+
+
+// what a running system sees: the world, its own declarations, and the pool for chunked views
+class SystemContext {
+public:
+	SystemContext(ECS& ecs, TaskPool& pool, CommandQueue& commandQueue, const SystemDesc& desc)
+		: ecs(ecs), pool(pool), commandQueue(commandQueue), desc(desc) {}
+
+	ECS& ecs;
+
+	template<typename... Comps, typename... Excludes>
+	View<Exclude<Excludes...>, Comps...> view(Exclude<Excludes...> filter = {})
+	{
+		assert((declared<Comps>() && ...) && "system uses a component it did not declare");
+		assert((declared<Excludes>() && ...) && "system filters on a component it did not declare");
+		return ecs.view<Comps...>(filter);
+	}
+
+	// run a view in chunks of grainSize driver entries across the pool
+	template<typename ViewType, typename Func>
+	void parallelEach(const ViewType& view, size_t grainSize, Func&& fn)
+	{
+		pool.parallelFor(view.sizeHint(), grainSize, [&](size_t begin, size_t end) {
+			view.each(begin, end, fn);
+			});
+	}
+
+	// entries added/patched by others since this system last ran
+	template<typename Comp_t>
+	ChangedView<Comp_t> changed()
+	{
+		assert(declared<Comp_t>() && "system uses a component it did not declare");
+		return ecs.changed<Comp_t>(desc.lastRunTick);
+	}
+
+	template<typename Comp_t>
+	ChangedView<Comp_t> added()
+	{
+		assert(declared<Comp_t>() && "system uses a component it did not declare");
+		return ecs.added<Comp_t>(desc.lastRunTick);
+	}
+
+	// write that later changed<Comp_t>() queries of other systems will see
+	template<typename Comp_t>
+	Comp_t* patch(const uint32_t id)
+	{
+		assert(find(desc.writes.begin(), desc.writes.end(), type_index(typeid(Comp_t))) != desc.writes.end()
+			&& "system patches a component it did not declare as written");
+		return ecs.patch<Comp_t>(id);
+	}
+
+	// deferred create/destroy/add/remove, safe from any thread, also inside parallelEach
+	CommandBuffer& commands() { return commandQueue.local(); }
+
+	const string& name() const { return desc.name; }
+
+private:
+	template<typename Comp_t>
+	bool declared() const
+	{
+		const type_index type = typeid(Comp_t);
+		return find(desc.reads.begin(), desc.reads.end(), type) != desc.reads.end()
+			|| find(desc.writes.begin(), desc.writes.end(), type) != desc.writes.end();
+	}
+
+	TaskPool& pool;
+	CommandQueue& commandQueue;
+	const SystemDesc& desc;
+};
+
+
+class SystemScheduler {
+public:
+	explicit SystemScheduler(ECS& ecs, uint32_t numThreads = TaskPool::defaultThreadCount())
+		: ecs(ecs), pool(numThreads) {}
+
+	SystemScheduler(const SystemScheduler&) = delete;
+	SystemScheduler& operator=(const SystemScheduler&) = delete;
+
+	template<typename... Reads, typename... Writes, typename Func>
+	void addSystem(const string& name, Read<Reads...>, Write<Writes...>, Func&& fn)
+	{
+		SystemDesc desc;
+		desc.name = name;
+		desc.reads = { type_index(typeid(Reads))... };
+		desc.writes = { type_index(typeid(Writes))... };
+		desc.fn = std::forward<Func>(fn);
+		desc.stage = numStages - 1;
+		systems.push_back(std::move(desc));
+		bDirty = true;
+	}
+
+	// systems added after this start once the earlier ones are done and their commands applied
+	void addSyncPoint()
+	{
+		++numStages;
+		bDirty = true;
+	}
+
+	// edge i -> j for every earlier system i of the same stage that conflicts with j
+	void build()
+	{
+		for (auto& system : systems) {
+			system.successors.clear();
+			system.numDeps = 0;
+		}
+
+		for (uint32_t j = 0; j < systems.size(); ++j) {
+			for (uint32_t i = 0; i < j; ++i) {
+				if (systems[i].stage != systems[j].stage || !conflicts(systems[i], systems[j])) continue;
+				systems[i].successors.push_back(j);
+				++systems[j].numDeps;
+			}
+		}
+
+		remainingDeps = make_unique<atomic<uint32_t>[]>(systems.size());
+		bDirty = false;
+	}
+
+	void run()
+	{
+		if (systems.empty()) return;
+		if (bDirty) build();
+
+		for (uint32_t i = 0; i < systems.size(); ++i)
+			remainingDeps[i].store(systems[i].numDeps, memory_order_relaxed);
+
+		// systems are added stage by stage, so each stage is a contiguous range
+		uint32_t begin = 0;
+		while (begin < systems.size()) {
+			uint32_t end = begin;
+			while (end < systems.size() && systems[end].stage == systems[begin].stage) ++end;
+
+			pending.store(static_cast<int>(end - begin), memory_order_relaxed);
+			for (uint32_t i = begin; i < end; ++i)
+				if (systems[i].numDeps == 0) dispatch(i);
+			pool.waitFor(pending);
+
+			// sync point
+			commandQueue.apply(ecs);
+			begin = end;
+		}
+	}
+
+	void debugPrint() const
+	{
+		for (auto& system : systems) {
+			cout << "system: " << system.name << " stage: " << system.stage << " deps: " << system.numDeps << " -> ";
+			for (auto next : system.successors) cout << systems[next].name << ' ';
+			cout << '\n';
+		}
+	}
+
+	TaskPool& getPool() { return pool; }
+
+	// for recording outside of systems, applied with the next sync point
+	CommandQueue& getCommandQueue() { return commandQueue; }
+
+private:
+	static bool overlaps(const vector<type_index>& a, const vector<type_index>& b)
+	{
+		for (auto& type : a)
+			if (find(b.begin(), b.end(), type) != b.end()) return true;
+		return false;
+	}
+
+	static bool conflicts(const SystemDesc& a, const SystemDesc& b)
+	{
+		return overlaps(a.writes, b.writes) || overlaps(a.writes, b.reads) || overlaps(a.reads, b.writes);
+	}
+
+	void dispatch(uint32_t index)
+	{
+		pool.submit([this, index] {
+			auto& system = systems[index];
+			SystemContext ctx(ecs, pool, commandQueue, system);
+			system.fn(ctx);
+			// own writes are stamped at most with the tick this run ends on, every later one after the increment;
+			// a conflicting writer never overlaps this run, so nothing is missed and a system never sees itself
+			system.lastRunTick = ecs.incrementTick() - 1;
+
+			for (auto next : system.successors)
+				if (remainingDeps[next].fetch_sub(1, memory_order_acq_rel) == 1) dispatch(next);
+
+			if (pending.fetch_sub(1, memory_order_acq_rel) == 1) pool.wakeWaiters();
+			});
+	}
+
+private:
+	ECS& ecs;
+
+	vector<SystemDesc> systems;
+	unique_ptr<atomic<uint32_t>[]> remainingDeps;
+	atomic<int> pending{ 0 };
+	uint32_t numStages = 1;
+	bool bDirty = true;
+
+	CommandQueue commandQueue;
+
+	// last, so the workers are joined before the systems go away
+	TaskPool pool;
+};
@@ -1,6 +1,9 @@
 #include "ECS.h"
+#include "Archetype.h"
 
 #include <algorithm>
+#include <cassert>
+#include <string>
 using namespace std;
 
 struct Pos {
@@ -31,7 +34,59 @@ void updatePos(auto& ecs)
 }
 
 
+void moveSystem(ECS& ecs)
+{
+	ecs.view<Pos, Vel>().each([](uint32_t actor, Pos& pos, const Vel& vel) {
+		pos.x += vel.dx;
+		pos.y += vel.dy;
+		cout << "moved actor: " << actor << '\n';
+		});
+}
+
+
+struct Name {
+	string value;
+};
+
+// archetype mode: values survive the moves between archetypes, each() only visits actors with every component
+void archetypeMoves()
+{
+	ArchetypeECS ecs;
+	vector<uint32_t> actors;
+	for (int i = 0; i < 1000; ++i) {
+		const uint32_t actor = ecs.createActor();
+		actors.push_back(actor);
+		ecs.addComponent<Pos>(actor, Pos{ float(i), 0.0f });
+		ecs.addComponent<Name>(actor, Name{ "actor " + to_string(i) });
+		if (i % 2 == 0) ecs.addComponent<Vel>(actor, Vel{ 1.0f, 2.0f });
+	}
+
+	// takes Pos out of the middle of {Pos, Vel, Name} and puts it back after the others
+	for (int i = 0; i < 1000; i += 4) {
+		ecs.removeComponent<Pos>(actors[i]);
+		ecs.addComponent<Pos>(actors[i], Pos{ float(i), 0.0f });
+	}
+	for (int i = 1; i < 1000; i += 4) ecs.removeComponent<Name>(actors[i]);
+
+	int moving = 0;
+	ecs.each<Pos, Vel>([&](uint32_t actor, Pos& pos, const Vel& vel) {
+		pos.x += vel.dx;
+		pos.y += vel.dy;
+		++moving;
+		});
+	assert(moving == 500);
+
+	for (int i = 0; i < 1000; ++i) {
+		const Pos* pos = ecs.getComponent<Pos>(actors[i]);
+		assert(pos && pos->x == float(i) + (i % 2 == 0 ? 1.0f : 0.0f));
+		const Name* name = ecs.getComponent<Name>(actors[i]);
+		assert((i % 4 == 1) == (name == nullptr));
+		assert(!name || name->value == "actor " + to_string(i));
+		assert(ecs.hasComponent<Vel>(actors[i]) == (i % 2 == 0));
+	}
 
+	cout << "archetype moves: " << moving << " moving actors in " << ecs.archetypeCount() << " archetypes" << '\n';
+}
 
 
 
@@ -76,4 +131,7 @@ int main()
 
 	updatePos(ecs);
 
+	moveSystem(ecs);
+
+	archetypeMoves();
 }
\ No newline at end of file
@@ -2,32 +2,82 @@
 
 #include <vector>
 #include <optional>
-#include <variant>
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
 #include <iostream> 
 
 
 #include "Math.h"
 #include "Ray.h"
+#include "ThreadPool.h"
+#include "WideBVH.h"
+#include "RayPacket.h"
 
 
 using namespace std;
  
 
 //similar to small object optimization
-constexpr uint32_t MAX_LEAF_SIZE = 4;
+constexpr uint32_t DEFAULT_LEAF_SIZE = 4;
 
-constexpr float EPSILON = 1e-6f;
+constexpr uint32_t MAX_SAH_BINS = 32;
+
+//traversal keeps a fixed stack of this many entries, the builder keeps the tree at most this deep
+constexpr uint32_t BVH_MAX_DEPTH = 64;
+
+//refit() splits the tree into about this many subtrees
+constexpr uint32_t REFIT_SUBTREES = 64;
 
 struct alignas(16) Bounds3 {
     alignas(16) vec3 min{}, max{};
 
+    //empty bounds are inverted, the first grow() sets both corners
     Bounds3() {
 		min = vec3(MAX_SCALAR_V);
-		max = vec3(MIN_SCALAR_V); 
+		max = vec3(-MAX_SCALAR_V); 
+    }
+
+    void grow(const vec3& p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void grow(const Bounds3& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    vec3 centroid() const { return 0.5f * (min + max); }
+
+    float surfaceArea() const {
+        if (min.x > max.x) return 0.0f;
+        vec3 e = max - min;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
     }
 };
 
+/*
+* slab test returning the entry distance, or MAX_SCALAR_V on a miss;
+* boxes entered at or beyond t_max count as missed, that is the early-out on the closest hit.
+*/
+inline float AABB_intersectDistance(const vec3& bounds_min, const vec3& bounds_max, const Ray& ray, float t_max)
+{
+    vec3 t0 = (bounds_min - ray.origin) * ray.invertDir;
+    vec3 t1 = (bounds_max - ray.origin) * ray.invertDir;
+    vec3 t_near = glm::min(t0, t1);
+    vec3 t_far = glm::max(t0, t1);
+
+    float max_enter = max3(t_near.x, t_near.y, t_near.z);
+    float min_exit = min3(t_far.x, t_far.y, t_far.z);
+
+    //same tolerance as AABB_intersect; a ray starting inside enters at a negative t
+    if (min_exit > 0 && max_enter <= min_exit + EPSILON && max_enter < t_max)
+        return max_enter;
+    return MAX_SCALAR_V;
+}
+
 inline bool AABB_intersect(const Bounds3& bounds, const Ray& ray) 
 {
     vec3 invDir = ray.invertDir; 
@@ -76,239 +126,1408 @@ concept RTPrimitive = requires(T t, const Ray& ray) {
 };
 
 
+/*
+* by default leaves test their primitives one by one through Primitive::intersect.
+* a primitive type may specialize LeafAccel with its own leaf data, built from the leaves after every build,
+* and RayData, what it precomputes once per ray; see Triangle.h.
+*/
+template<typename Primitive>
+struct LeafAccel {
+    static constexpr bool bEnabled = false;
 
-struct LeafNode {
-    uint32_t first_prim; // Index of the first primitive in this leaf
-    uint16_t prim_count; // Number of primitives in this leaf
+    struct RayData {
+        RayData() = default;
+        explicit RayData(const Ray&) {}
+    };
 };
 
-// Define data specific to an internal node
-struct InternalNode {
-    uint32_t left_child; // Index of the left child node
-};
 
 
+/*
+* 32 bytes, two nodes per cache line.
+* prim_count == 0 marks an interior node, its children are left_first and left_first + 1;
+* otherwise a leaf over primitives [left_first, left_first + prim_count).
+*/
 struct alignas(32) BVHNode {
-	Bounds3 bounds;           // Bounding box of the node
-     
-	variant<LeafNode, InternalNode> node_dataType;
+    vec3 bounds_min{ MAX_SCALAR_V };
+    uint32_t left_first = 0;
+    vec3 bounds_max{ -MAX_SCALAR_V };
+    uint32_t prim_count = 0;
+
+    bool is_leaf() const { return prim_count != 0; }
+
+    Bounds3 bounds() const {
+        Bounds3 result;
+        result.min = bounds_min;
+        result.max = bounds_max;
+        return result;
+    }
 
-    bool is_leaf() const {
-        return  holds_alternative<LeafNode>(node_dataType);
+    void setBounds(const Bounds3& bounds) {
+        bounds_min = bounds.min;
+        bounds_max = bounds.max;
     }
-    const LeafNode& as_leaf() const {
-        return std::get<LeafNode>(node_dataType);
+
+    void makeLeaf(uint32_t first_prim, uint32_t count) {
+        left_first = first_prim;
+        prim_count = count;
     }
 
-    const InternalNode& as_internal() const {
-        return std::get<InternalNode>(node_dataType);
+    void makeInterior(uint32_t left_child) {
+        left_first = left_child;
+        prim_count = 0;
     }
-}; 
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode is meant to be half a cache line");
+
+
+/*
+* costs are relative, only their ratio matters to the SAH;
+* a leaf is made once splitting would cost more than testing every primitive,
+* or earlier if it is already at maxLeafSize.
+* ranges of at least subtreeSize primitives are split with every thread binning and partitioning,
+* smaller ones become whole subtrees built by one thread each.
+* width 4 or 8 collapses the finished binary tree into wide nodes that intersect() then traverses;
+* the binary nodes are kept either way.
+* refit() rebuilds what its SAH cost grew past refitRebuildRatio times the cost after the last build; 0 never does.
+*/
+struct BVHBuildConfig {
+    uint32_t maxLeafSize = DEFAULT_LEAF_SIZE;
+    uint32_t numBins = 16;
+    float traversalCost = 1.0f;
+    float intersectCost = 1.0f;
+
+    bool bParallel = true;
+    uint32_t subtreeSize = 1u << 14;
+    ThreadPool* pool = nullptr;   //null: ThreadPool::shared()
+
+    uint32_t width = 4;           //2, 4 or 8
+
+    float refitRebuildRatio = 1.5f;
+};
 
 
 template<RTPrimitive Primitive>
 class BVH {
 public:
-    BVH(vector<Primitive>& prims):
-		primitives(prims)
+    BVH(vector<Primitive>& prims, const BVHBuildConfig& config = {}):
+		primitives(prims), config(config)
     {
         build(prims);
     }
      
 	void build(vector<Primitive>& prims); 
 
+    /*
+    * after the primitives moved but kept their order: node bounds are recomputed bottom-up, the topology kept.
+    * subtrees that degraded past config.refitRebuildRatio are rebuilt in place, the whole tree if the top did or most of it;
+    * a rebuild reorders the primitives it covers, like build(). returns true if anything was rebuilt.
+    */
+    bool refit(vector<Primitive>& prims);
+    //expected cost of a ray through the tree by the builder's SAH, per unit root area
+    float sahCost() const;
+
 	optional<Intersection> intersect(const Ray& ray) const;
-    optional<Intersection> leaf_intersect(const BVHNode& node, const Ray& ray) const;
+    //any hit before ray.t_max, for shadow rays
+    bool occluded(const Ray& ray) const;
+    using LeafRay = typename LeafAccel<Primitive>::RayData;
+    optional<Intersection> leaf_intersect(uint32_t first_prim, uint32_t prim_count, const Ray& ray, const LeafRay& leafRay, float closest_t) const;
+    bool leaf_occluded(uint32_t first_prim, uint32_t prim_count, const Ray& ray, const LeafRay& leafRay, float closest_t) const;
+
+    //closest hit per lane
+    template<uint32_t Size>
+    array<optional<Intersection>, Size> intersect(const RayPacket<Size>& packet) const;
+
+    //a bit per lane blocked before its t_max, for shadow rays
+    template<uint32_t Size>
+    uint32_t occluded(const RayPacket<Size>& packet) const;
+
+    /*
+    * the lanes in mask, each up to its closest_t, which drops at every hit; the entry for leaves that trace on
+    * into a BVH of their own, an Instance into its BLAS. returns the lanes hit, with bAnyHit the lanes blocked.
+    */
+    template<bool bAnyHit, uint32_t Size>
+    uint32_t tracePacket(const RayPacket<Size>& packet, uint32_t mask, float* closest_t, optional<Intersection>* hits) const;
 
 	vector<BVHNode> nodes;
+    vector<BVHWideNode<4>> wideNodes4;
+    vector<BVHWideNode<8>> wideNodes8;
      
 	const vector<Primitive>& primitives;
+    LeafAccel<Primitive> leafAccel;
+
+    BVHBuildConfig config;
+
+private:
+    template<bool bAnyHit>
+    optional<Intersection> intersectBinary(const Ray& ray) const;
+
+    template<bool bAnyHit, uint32_t Width>
+    optional<Intersection> intersectWide(const vector<BVHWideNode<Width>>& wideNodes, const Ray& ray) const;
+
+    //from the wide node or leaf (root_child, root_count) up to closest_t, with the ray data already set up
+    template<bool bAnyHit, uint32_t Width>
+    optional<Intersection> traverseWide(const vector<BVHWideNode<Width>>& wideNodes, const Ray& ray, const WideRay& wideRay,
+        const LeafRay& leafRay, float closest_t, uint32_t root_child, uint32_t root_count) const;
+
+    template<bool bAnyHit, uint32_t Size>
+    uint32_t traversePacket(const RayPacket<Size>& packet, uint32_t mask, float* closest_t, optional<Intersection>* hits) const;
+
+    template<bool bAnyHit, uint32_t Width, uint32_t Size>
+    uint32_t traversePacketWide(const vector<BVHWideNode<Width>>& wideNodes, const RayPacket<Size>& packet,
+        uint32_t mask, float* closest_t, optional<Intersection>* hits) const;
+
+    template<bool bAnyHit, uint32_t Size>
+    uint32_t packetLeaf(uint32_t first_prim, uint32_t prim_count, const RayPacket<Size>& packet, uint32_t mask,
+        const LeafRay* leafRays, float* closest_t, optional<Intersection>* hits) const;
+
+    //unnormalized SAH cost of the subtree at node_index; refitNode() recomputes its bounds on the way
+    float nodeCost(uint32_t node_index) const;
+    float refitNode(uint32_t node_index, const vector<Primitive>& prims);
+
+    //picks the subtrees refit() works on and records their cost and the top's as built
+    void prepareRefit();
+    void rebuildSubtrees(vector<Primitive>& prims, const vector<uint32_t>& degraded);
+
+    //a subtree refit by one thread and rebuilt on its own once degraded
+    struct RefitSubtree {
+        uint32_t node_index;
+        uint32_t start_primIndex;
+        uint32_t end_primIndex;
+        uint32_t depth;
+        float builtCost;    //per unit area of its root
+    };
+    vector<RefitSubtree> refitSubtrees;
+    vector<uint32_t> refitTop;    //interior nodes above the subtrees, parents first
+    float topBuiltCost = 0.0f;    //unnormalized, of the refitTop nodes; only build() rebuilds them, so only it moves this
 };
  
 
 
-inline uint8_t selectSplitAxisIndex(const Bounds3& bound) {
-    auto min = bound.min;
-    auto max = bound.max;
-    vec3 extents{ max[0] - min[0], max[1] - min[1], max[2] - min[2] };
+//computed once per build, the builder never calls getBoundingBox() again
+struct PrimRef {
+    Bounds3 bounds;
+    vec3 centroid;
+    uint32_t index;
+};
+
+struct SAHSplit {
+    uint8_t axis = 0;
+    uint32_t bin = 0;           //refs in bins below this go left
+    float cost = MAX_SCALAR_V;  //stays max if no plane separates the centroids
+};
 
-    if (extents.x >= extents.y && extents.x >= extents.z) {
-        return 0;
-    }
-    else if (extents.y >= extents.z) {
-        return 1;
-    }
-    else {
-        return 2;
-    }
+inline uint32_t binIndex(const vec3& centroid, uint8_t axis, const Bounds3& centroidBounds, uint32_t numBins) {
+    float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+    int bin = static_cast<int>((centroid[axis] - centroidBounds.min[axis]) / extent * numBins);
+    return static_cast<uint32_t>(std::clamp(bin, 0, static_cast<int>(numBins) - 1));
 }
 
-//similar to quicksort partitioning
-template<RTPrimitive Primitive>
-inline uint32_t partition_primitives(std::vector<Primitive>& prims, uint32_t start, uint32_t end, uint8_t axis) {
-    
-	//the partitioning value is the average of the centroids of the primitives
-    double split_value = 0.0;
-    for (uint32_t i = start; i < end; ++i) {
-        auto [prim_min, prim_max] = prims[i].getBoundingBox();
-        split_value += 0.5 * (prim_min[axis] + prim_max[axis]);
+//bins of all three axes, filled per range and merged when several threads bin one node
+struct SAHBins {
+    struct Bin {
+        Bounds3 bounds;
+        uint32_t count = 0;
+    };
+
+    Bin bins[3][MAX_SAH_BINS];
+
+    void add(const vector<PrimRef>& refs, uint32_t start, uint32_t end, const Bounds3& centroidBounds, uint32_t numBins) {
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            //flat axes are skipped by evaluate(), binning them would divide by zero
+            if (centroidBounds.max[axis] <= centroidBounds.min[axis]) continue;
+
+            for (uint32_t i = start; i < end; ++i) {
+                auto& bin = bins[axis][binIndex(refs[i].centroid, axis, centroidBounds, numBins)];
+                bin.bounds.grow(refs[i].bounds);
+                ++bin.count;
+            }
+        }
     }
-    split_value /= (end - start); 
 
-    auto mid_iter = std::partition(prims.begin() + start, prims.begin() + end,
-        [axis, split_value](const Primitive& prim) {
-            auto [prim_min, prim_max] = prim.getBoundingBox();
-            double centroid = 0.5 * (prim_min[axis] + prim_max[axis]);
-            return centroid < split_value;
-        });
+    void merge(const SAHBins& other, uint32_t numBins) {
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            for (uint32_t b = 0; b < numBins; ++b) {
+                bins[axis][b].bounds.grow(other.bins[axis][b].bounds);
+                bins[axis][b].count += other.bins[axis][b].count;
+            }
+        }
+    }
 
-    uint32_t mid = static_cast<uint32_t>(std::distance(prims.begin(), mid_iter));
+    /*
+    * every bin boundary is a candidate plane;
+    * cost = traversal + intersect * (A_left * N_left + A_right * N_right) / A_node
+    */
+    SAHSplit evaluate(const Bounds3& nodeBounds, const Bounds3& centroidBounds, uint32_t numBins, const BVHBuildConfig& config) const {
+        const float nodeArea = nodeBounds.surfaceArea();
+        const float invNodeArea = nodeArea > 0.0f ? 1.0f / nodeArea : 1.0f;
+
+        SAHSplit best;
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            if (centroidBounds.max[axis] <= centroidBounds.min[axis]) continue;
+
+            //sweep from the right to get the right side of every plane, then from the left
+            float rightArea[MAX_SAH_BINS];
+            uint32_t rightCount[MAX_SAH_BINS];
+            Bounds3 accum;
+            uint32_t count = 0;
+            for (uint32_t b = numBins - 1; b > 0; --b) {
+                accum.grow(bins[axis][b].bounds);
+                count += bins[axis][b].count;
+                rightArea[b] = accum.surfaceArea();
+                rightCount[b] = count;
+            }
+
+            accum = Bounds3{};
+            count = 0;
+            for (uint32_t b = 1; b < numBins; ++b) {
+                accum.grow(bins[axis][b - 1].bounds);
+                count += bins[axis][b - 1].count;
+                if (count == 0 || rightCount[b] == 0) continue;
+
+                float cost = config.traversalCost + config.intersectCost * invNodeArea
+                    * (accum.surfaceArea() * count + rightArea[b] * rightCount[b]);
+                if (cost < best.cost) {
+                    best = { axis, b, cost };
+                }
+            }
+        }
 
-    // Handle cases where partitioning fails
-    if (mid == start || mid == end) {
-        mid = start + (end - start) / 2;
+        return best;
     }
+};
 
-    return mid;
+inline uint32_t sahBinCount(const BVHBuildConfig& config) {
+    return std::clamp(config.numBins, 2u, MAX_SAH_BINS);
 }
 
+inline bool makesLeaf(uint32_t prim_count, const SAHSplit& split, const BVHBuildConfig& config) {
+    return prim_count <= config.maxLeafSize && config.intersectCost * prim_count <= split.cost;
+}
 
-
-template<RTPrimitive Primitive>
-inline Bounds3 UnionBounds(const std::vector<Primitive>& primitives, uint32_t start, uint32_t end) {
-    Bounds3 retBounds;
-    for (uint32_t i = start; i < end; ++i) {
-        auto thisBound = primitives[i].getBoundingBox();
-        retBounds.min = min(retBounds.min, thisBound.min);
-        retBounds.max = max(retBounds.max, thisBound.max);
-    }
-    return retBounds;
+/*
+* past this depth splits are object medians, which halve the range each level,
+* so no tree gets deeper than BVH_MAX_DEPTH for any 32-bit primitive count.
+*/
+inline bool needsMedianSplit(uint32_t depth) {
+    return depth >= BVH_MAX_DEPTH - 32;
 }
 
- 
+inline uint32_t medianSplit(vector<PrimRef>& refs, uint32_t start, uint32_t end, const Bounds3& centroidBounds) {
+    vec3 extent = centroidBounds.max - centroidBounds.min;
+    uint8_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
 
-template<RTPrimitive Primitive>
-void BVH<Primitive>::build(vector<Primitive>& primitives) {
-    if (primitives.empty()) return;
+    uint32_t mid = start + (end - start) / 2;
+    std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+        [axis](const PrimRef& a, const PrimRef& b) { return a.centroid[axis] < b.centroid[axis]; });
+    return mid;
+}
 
-    nodes.clear();
-    nodes.reserve(primitives.size() * 2); // Reserve space to minimize reallocations
+
+/*
+* single-threaded build of refs[start, end) into out, root at out[0] and at depth in the whole tree;
+* child indices are local to out, leaf ranges are global indices into refs.
+*/
+inline void buildSubtree(vector<PrimRef>& refs, uint32_t start, uint32_t end, uint32_t depth, const BVHBuildConfig& config, vector<BVHNode>& out) {
+    const uint32_t numBins = sahBinCount(config);
 
     struct BuildTask {
         uint32_t node_index;
         uint32_t start_primIndex;
         uint32_t end_primIndex;
+        uint32_t depth;
     };
 
     // Initialize root node
-    nodes.emplace_back();
-    BuildTask root_task = { 0, 0, static_cast<uint32_t>(primitives.size()) };
-    vector<BuildTask> taskStack = { root_task };
+    out.emplace_back();
+    vector<BuildTask> taskStack = { BuildTask{ static_cast<uint32_t>(out.size() - 1), start, end, depth } };
 
     while (!taskStack.empty()) {
         BuildTask task = taskStack.back();
         taskStack.pop_back();
 
-        BVHNode& node = nodes[task.node_index];
-
-        //recompute bounds
-        node.bounds = UnionBounds<Primitive>(primitives, task.start_primIndex, task.end_primIndex);
+        Bounds3 bounds, centroidBounds;
+        for (uint32_t i = task.start_primIndex; i < task.end_primIndex; ++i) {
+            bounds.grow(refs[i].bounds);
+            centroidBounds.grow(refs[i].centroid);
+        }
+        out[task.node_index].setBounds(bounds);
 
         uint32_t prim_count = task.end_primIndex - task.start_primIndex;
 
+        SAHSplit split;
+        if (prim_count > 1) {
+            SAHBins bins;
+            bins.add(refs, task.start_primIndex, task.end_primIndex, centroidBounds, numBins);
+            split = bins.evaluate(bounds, centroidBounds, numBins, config);
+        }
+
         // Leaf node
-        if (prim_count <= MAX_LEAF_SIZE) { 
-			node.node_dataType = LeafNode{ task.start_primIndex, static_cast<uint16_t>(prim_count) };
-			cout << "built leaf node" << '\n';
+        if (makesLeaf(prim_count, split, config)) {
+            out[task.node_index].makeLeaf(task.start_primIndex, prim_count);
             continue;
         }
-         
-            // Internal node 
-        auto axis = selectSplitAxisIndex(node.bounds); 
 
-        uint32_t mid = partition_primitives<Primitive>(primitives, task.start_primIndex, task.end_primIndex, axis);
+        // Internal node
+        uint32_t mid;
+        if (needsMedianSplit(task.depth)) {
+            mid = medianSplit(refs, task.start_primIndex, task.end_primIndex, centroidBounds);
+        }
+        else if (split.cost < MAX_SCALAR_V) {
+            auto mid_iter = std::partition(refs.begin() + task.start_primIndex, refs.begin() + task.end_primIndex,
+                [&](const PrimRef& ref) {
+                    return binIndex(ref.centroid, split.axis, centroidBounds, numBins) < split.bin;
+                });
+            mid = static_cast<uint32_t>(std::distance(refs.begin(), mid_iter));
+        }
+        else {
+            //all centroids coincide, any halving is as good as another
+            mid = task.start_primIndex + prim_count / 2;
+        }
 
         // Create child nodes
-        uint32_t left_child_index = static_cast<uint32_t>(nodes.size());
-        nodes.emplace_back();
-        uint32_t right_child_index = static_cast<uint32_t>(nodes.size());
-        nodes.emplace_back();
+        uint32_t left_child_index = static_cast<uint32_t>(out.size());
+        out.emplace_back();
+        uint32_t right_child_index = static_cast<uint32_t>(out.size());
+        out.emplace_back();
 
-		node.node_dataType = InternalNode{ left_child_index };
+        out[task.node_index].makeInterior(left_child_index);
 
         // Push tasks for child nodes
-        taskStack.push_back({ left_child_index, task.start_primIndex, mid });
-        taskStack.push_back({ right_child_index, mid, task.end_primIndex });
-        
+        taskStack.push_back({ left_child_index, task.start_primIndex, mid, task.depth + 1 });
+        taskStack.push_back({ right_child_index, mid, task.end_primIndex, task.depth + 1 });
     }
+}
+
+
+
+/*
+* each wide node takes the two children of a binary node, then keeps opening its largest interior child
+* until Width slots are used or only leaves are left; larger children are the likelier hits worth flattening.
+*/
+template<uint32_t Width>
+vector<BVHWideNode<Width>> collapseBVH(const vector<BVHNode>& nodes) {
+    vector<BVHWideNode<Width>> wideNodes;
+    if (nodes.empty()) return wideNodes;
+    wideNodes.reserve(nodes.size() / (Width / 2) + 1);
 
+    struct CollapseTask {
+        uint32_t node_index;
+        uint32_t wide_index;
+    };
+
+    wideNodes.emplace_back();
+    vector<CollapseTask> taskStack = { { 0, 0 } };
+
+    while (!taskStack.empty()) {
+        CollapseTask task = taskStack.back();
+        taskStack.pop_back();
+
+        uint32_t slots[Width];
+        uint32_t slot_count = 0;
+        if (nodes[task.node_index].is_leaf()) {
+            //only a leaf root gets here
+            slots[slot_count++] = task.node_index;
+        }
+        else {
+            slots[slot_count++] = nodes[task.node_index].left_first;
+            slots[slot_count++] = nodes[task.node_index].left_first + 1;
+        }
+
+        while (slot_count < Width) {
+            int largest = -1;
+            float largest_area = -1.0f;
+            for (uint32_t i = 0; i < slot_count; ++i) {
+                const BVHNode& node = nodes[slots[i]];
+                if (!node.is_leaf() && node.bounds().surfaceArea() > largest_area) {
+                    largest = static_cast<int>(i);
+                    largest_area = node.bounds().surfaceArea();
+                }
+            }
+            if (largest < 0) break;
+
+            uint32_t left_child = nodes[slots[largest]].left_first;
+            slots[largest] = left_child;
+            slots[slot_count++] = left_child + 1;
+        }
+
+        for (uint32_t i = 0; i < slot_count; ++i) {
+            const BVHNode& node = nodes[slots[i]];
+
+            uint32_t child = node.left_first;
+            if (!node.is_leaf()) {
+                child = static_cast<uint32_t>(wideNodes.size());
+                wideNodes.emplace_back();
+                taskStack.push_back({ slots[i], child });
+            }
+
+            auto& wide = wideNodes[task.wide_index];
+            wide.min_x[i] = node.bounds_min.x;
+            wide.min_y[i] = node.bounds_min.y;
+            wide.min_z[i] = node.bounds_min.z;
+            wide.max_x[i] = node.bounds_max.x;
+            wide.max_y[i] = node.bounds_max.y;
+            wide.max_z[i] = node.bounds_max.z;
+            wide.child[i] = child;
+            wide.count[i] = node.prim_count;
+        }
+    }
+
+    return wideNodes;
 }
 
+
+
+/*
+* parallel build: the top of the tree is split on the calling thread, each split binned and partitioned by all threads;
+* ranges below subtreeSize are queued as whole subtrees, built into their own node arrays,
+* and appended to nodes once all are done.
+*/
 template<RTPrimitive Primitive>
-std::optional<Intersection> BVH<Primitive>::leaf_intersect(const BVHNode& node, const Ray& ray) const {
-    auto _node = node.as_leaf();
-    auto closest_t = ray.t_max;
-    std::optional<Intersection> closest_intersection;
- 
-    for (uint32_t i = _node.first_prim; i < _node.first_prim + _node.prim_count; ++i) {
-        const auto& primitive = primitives[i];
+void BVH<Primitive>::build(vector<Primitive>& primitives) {
+    nodes.clear();
+    if (primitives.empty()) return;
+
+    const uint32_t primCount = static_cast<uint32_t>(primitives.size());
+    const uint32_t numBins = sahBinCount(config);
+
+    ThreadPool& pool = config.pool ? *config.pool : ThreadPool::shared();
+    //the top-level loop has no leaf case, so it must hand ranges off while they can still be split
+    const uint32_t subtreeSize = std::max(config.subtreeSize, config.maxLeafSize + 1);
+    const bool bParallel = config.bParallel && primCount >= subtreeSize;
+
+    //chunked ranges for the parallel passes, big enough to amortize a task
+    constexpr uint32_t minChunk = 4096;
+    auto forChunks = [&](uint32_t start, uint32_t end, auto&& fn) {
+        const uint32_t count = end - start;
+        const uint32_t numChunks = std::max(1u, std::min((pool.threadCount() + 1) * 2, count / minChunk));
+        const uint32_t chunkSize = (count + numChunks - 1) / numChunks;
+        pool.parallelFor(numChunks, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c) {
+                uint32_t begin = std::min(end, start + static_cast<uint32_t>(c) * chunkSize);
+                fn(static_cast<uint32_t>(c), begin, std::min(end, begin + chunkSize));
+            }
+            });
+        return numChunks;
+    };
+
+    vector<PrimRef> refs(primCount);
+    auto makeRefs = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto bounds = primitives[i].getBoundingBox();
+            refs[i] = { bounds, bounds.centroid(), static_cast<uint32_t>(i) };
+        }
+    };
+    if (bParallel) pool.parallelFor(primCount, minChunk, makeRefs);
+    else makeRefs(0, primCount);
+
+    nodes.reserve(primCount * 2); // Reserve space to minimize reallocations
+
+    struct SubtreeTask {
+        uint32_t node_index;
+        uint32_t start_primIndex;
+        uint32_t end_primIndex;
+        uint32_t depth;
+    };
+    vector<SubtreeTask> subtrees;
+
+    if (!bParallel) {
+        buildSubtree(refs, 0, primCount, 0, config, nodes);
+    }
+    else {
+        nodes.emplace_back();
+        vector<SubtreeTask> taskStack = { { 0, 0, primCount, 0 } };
+        vector<PrimRef> scratch(primCount);
+
+        while (!taskStack.empty()) {
+            SubtreeTask task = taskStack.back();
+            taskStack.pop_back();
+
+            const uint32_t prim_count = task.end_primIndex - task.start_primIndex;
+            if (prim_count < subtreeSize) {
+                subtrees.push_back(task);
+                continue;
+            }
+
+            //bounds, then bins, each reduced over per-chunk partials
+            const uint32_t maxChunks = (pool.threadCount() + 1) * 2;
+            vector<Bounds3> chunkBounds(maxChunks), chunkCentroids(maxChunks);
+            uint32_t numChunks = forChunks(task.start_primIndex, task.end_primIndex, [&](uint32_t c, uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; ++i) {
+                    chunkBounds[c].grow(refs[i].bounds);
+                    chunkCentroids[c].grow(refs[i].centroid);
+                }
+                });
+
+            Bounds3 bounds, centroidBounds;
+            for (uint32_t c = 0; c < numChunks; ++c) {
+                bounds.grow(chunkBounds[c]);
+                centroidBounds.grow(chunkCentroids[c]);
+            }
+            nodes[task.node_index].setBounds(bounds);
+
+            vector<SAHBins> chunkBins(maxChunks);
+            forChunks(task.start_primIndex, task.end_primIndex, [&](uint32_t c, uint32_t begin, uint32_t end) {
+                chunkBins[c].add(refs, begin, end, centroidBounds, numBins);
+                });
+            for (uint32_t c = 1; c < numChunks; ++c) {
+                chunkBins[0].merge(chunkBins[c], numBins);
+            }
+            SAHSplit split = chunkBins[0].evaluate(bounds, centroidBounds, numBins, config);
+
+            uint32_t mid = task.start_primIndex + prim_count / 2;
+            if (needsMedianSplit(task.depth)) {
+                mid = medianSplit(refs, task.start_primIndex, task.end_primIndex, centroidBounds);
+            }
+            else if (split.cost < MAX_SCALAR_V) {
+                //stable partition: count the left side per chunk, then scatter through scratch
+                auto goesLeft = [&](const PrimRef& ref) {
+                    return binIndex(ref.centroid, split.axis, centroidBounds, numBins) < split.bin;
+                };
+
+                vector<uint32_t> leftCount(maxChunks, 0), rightCount(maxChunks, 0), leftOffset(maxChunks), rightOffset(maxChunks);
+                forChunks(task.start_primIndex, task.end_primIndex, [&](uint32_t c, uint32_t begin, uint32_t end) {
+                    for (uint32_t i = begin; i < end; ++i) leftCount[c] += goesLeft(refs[i]);
+                    rightCount[c] = end - begin - leftCount[c];
+                    });
+
+                uint32_t totalLeft = 0;
+                for (uint32_t c = 0; c < numChunks; ++c) totalLeft += leftCount[c];
+
+                uint32_t left = task.start_primIndex, right = task.start_primIndex + totalLeft;
+                for (uint32_t c = 0; c < numChunks; ++c) {
+                    leftOffset[c] = left;
+                    rightOffset[c] = right;
+                    left += leftCount[c];
+                    right += rightCount[c];
+                }
+
+                forChunks(task.start_primIndex, task.end_primIndex, [&](uint32_t c, uint32_t begin, uint32_t end) {
+                    uint32_t l = leftOffset[c], r = rightOffset[c];
+                    for (uint32_t i = begin; i < end; ++i) {
+                        scratch[goesLeft(refs[i]) ? l++ : r++] = refs[i];
+                    }
+                    });
+                forChunks(task.start_primIndex, task.end_primIndex, [&](uint32_t, uint32_t begin, uint32_t end) {
+                    std::copy(scratch.begin() + begin, scratch.begin() + end, refs.begin() + begin);
+                    });
+
+                mid = task.start_primIndex + totalLeft;
+            }
+
+            uint32_t left_child_index = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+            nodes.emplace_back();
+            nodes[task.node_index].makeInterior(left_child_index);
+
+            taskStack.push_back({ left_child_index, task.start_primIndex, mid, task.depth + 1 });
+            taskStack.push_back({ left_child_index + 1, mid, task.end_primIndex, task.depth + 1 });
+        }
+
+        //smallest first: a worker runs its newest task first, so the big subtrees start early and thieves take the small ones
+        std::sort(subtrees.begin(), subtrees.end(), [](const SubtreeTask& a, const SubtreeTask& b) {
+            return a.end_primIndex - a.start_primIndex < b.end_primIndex - b.start_primIndex;
+            });
+
+        vector<vector<BVHNode>> subtreeNodes(subtrees.size());
+        atomic<int> remaining{ static_cast<int>(subtrees.size()) };
+        for (size_t i = 0; i < subtrees.size(); ++i) {
+            pool.submit([&, i] {
+                subtreeNodes[i].reserve((subtrees[i].end_primIndex - subtrees[i].start_primIndex) * 2);
+                buildSubtree(refs, subtrees[i].start_primIndex, subtrees[i].end_primIndex, subtrees[i].depth, config, subtreeNodes[i]);
+                if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) pool.notifyDone();
+                });
+        }
+        pool.wait(remaining);
+
+        //local root replaces its placeholder, local node k >= 1 lands at offset + k - 1
+        for (size_t i = 0; i < subtrees.size(); ++i) {
+            auto& local = subtreeNodes[i];
+            const uint32_t offset = static_cast<uint32_t>(nodes.size());
+            auto relocate = [offset](const BVHNode& source) {
+                BVHNode node = source;
+                if (!node.is_leaf()) {
+                    node.left_first = offset + node.left_first - 1;
+                }
+                return node;
+            };
+
+            nodes[subtrees[i].node_index] = relocate(local[0]);
+            for (size_t k = 1; k < local.size(); ++k) {
+                nodes.push_back(relocate(local[k]));
+            }
+        }
+    }
+
+    //leaves address contiguous ranges, so the primitives take the order of the refs
+    vector<Primitive> ordered;
+    ordered.reserve(primCount);
+    for (auto& ref : refs) {
+        ordered.push_back(std::move(primitives[ref.index]));
+    }
+    primitives = std::move(ordered);
+
+    wideNodes4.clear();
+    wideNodes8.clear();
+    if (config.width == 4) wideNodes4 = collapseBVH<4>(nodes);
+    else if (config.width == 8) wideNodes8 = collapseBVH<8>(nodes);
+
+    if constexpr (LeafAccel<Primitive>::bEnabled) {
+        leafAccel.build(primitives, nodes, config);
+    }
+
+    prepareRefit();
+}
+
+
+inline float costPerArea(float cost, const Bounds3& bounds) {
+    const float area = bounds.surfaceArea();
+    return area > 0.0f ? cost / area : 0.0f;
+}
+
+template<RTPrimitive Primitive>
+float BVH<Primitive>::sahCost() const {
+    if (nodes.empty()) return 0.0f;
+    return costPerArea(nodeCost(0), nodes[0].bounds());
+}
+
+template<RTPrimitive Primitive>
+float BVH<Primitive>::nodeCost(uint32_t node_index) const {
+    const BVHNode& node = nodes[node_index];
+    const float area = node.bounds().surfaceArea();
+    if (node.is_leaf()) return area * config.intersectCost * node.prim_count;
+
+    return area * config.traversalCost + nodeCost(node.left_first) + nodeCost(node.left_first + 1);
+}
+
+template<RTPrimitive Primitive>
+float BVH<Primitive>::refitNode(uint32_t node_index, const vector<Primitive>& prims) {
+    BVHNode& node = nodes[node_index];
+
+    Bounds3 bounds;
+    float cost;
+    if (node.is_leaf()) {
+        for (uint32_t i = node.left_first; i < node.left_first + node.prim_count; ++i) {
+            bounds.grow(prims[i].getBoundingBox());
+        }
+        cost = bounds.surfaceArea() * config.intersectCost * node.prim_count;
+    }
+    else {
+        const uint32_t left = node.left_first;
+        cost = refitNode(left, prims) + refitNode(left + 1, prims);
+        bounds = nodes[left].bounds();
+        bounds.grow(nodes[left + 1].bounds());
+        cost += bounds.surfaceArea() * config.traversalCost;
+    }
+
+    node.setBounds(bounds);
+    return cost;
+}
+
+/*
+* the top is opened level by level until there are REFIT_SUBTREES subtrees, enough to share out and to rebuild few nodes at a time;
+* a subtree covers the primitives from its leftmost leaf to its rightmost.
+*/
+template<RTPrimitive Primitive>
+void BVH<Primitive>::prepareRefit() {
+    refitSubtrees.clear();
+    refitTop.clear();
+    if (nodes.empty()) return;
+
+    topBuiltCost = 0.0f;
+    vector<uint32_t> frontier = { 0 }, depths = { 0 };
+    for (uint32_t depth = 1; frontier.size() < REFIT_SUBTREES; ++depth) {
+        vector<uint32_t> next, nextDepths;
+        for (size_t i = 0; i < frontier.size(); ++i) {
+            const BVHNode& node = nodes[frontier[i]];
+            if (node.is_leaf()) {
+                next.push_back(frontier[i]);
+                nextDepths.push_back(depths[i]);
+                continue;
+            }
+            refitTop.push_back(frontier[i]);
+            topBuiltCost += node.bounds().surfaceArea() * config.traversalCost;
+            next.insert(next.end(), { node.left_first, node.left_first + 1 });
+            nextDepths.insert(nextDepths.end(), { depth, depth });
+        }
+        if (next.size() == frontier.size()) break;
+        frontier.swap(next);
+        depths.swap(nextDepths);
+    }
+
+    for (size_t i = 0; i < frontier.size(); ++i) {
+        uint32_t first = frontier[i], last = frontier[i];
+        while (!nodes[first].is_leaf()) first = nodes[first].left_first;
+        while (!nodes[last].is_leaf()) last = nodes[last].left_first + 1;
+
+        const BVHNode& root = nodes[frontier[i]];
+        refitSubtrees.push_back({ frontier[i], nodes[first].left_first, nodes[last].left_first + nodes[last].prim_count,
+            depths[i], costPerArea(nodeCost(frontier[i]), root.bounds()) });
+    }
+}
+
+/*
+* the subtrees are refit in parallel, then the top above them.
+* each subtree is checked against its own cost as built: degraded ones are built anew, the way build() builds small ranges.
+* the top is only ever rebuilt by build(), so it is held to its cost as of the last full build;
+* build() also takes over once the degraded subtrees cover most of the primitives, it would rebuild as much anyway.
+*/
+template<RTPrimitive Primitive>
+bool BVH<Primitive>::refit(vector<Primitive>& prims) {
+    if (nodes.empty()) return false;
+
+    ThreadPool& pool = config.pool ? *config.pool : ThreadPool::shared();
+
+    vector<float> costs(refitSubtrees.size());
+    auto refitRange = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            costs[i] = refitNode(refitSubtrees[i].node_index, prims);
+        }
+    };
+    if (config.bParallel) pool.parallelFor(refitSubtrees.size(), 1, refitRange);
+    else refitRange(0, refitSubtrees.size());
+
+    float topCost = 0.0f;
+    for (auto it = refitTop.rbegin(); it != refitTop.rend(); ++it) {
+        BVHNode& node = nodes[*it];
+        Bounds3 bounds = nodes[node.left_first].bounds();
+        bounds.grow(nodes[node.left_first + 1].bounds());
+        node.setBounds(bounds);
+        topCost += bounds.surfaceArea() * config.traversalCost;
+    }
+
+    bool bRebuilt = false;
+    const float ratio = config.refitRebuildRatio;
+    vector<uint32_t> degraded;
+    if (ratio > 0.0f) {
+        size_t degradedPrims = 0;
+        for (uint32_t i = 0; i < refitSubtrees.size(); ++i) {
+            const RefitSubtree& subtree = refitSubtrees[i];
+            if (costPerArea(costs[i], nodes[subtree.node_index].bounds()) > subtree.builtCost * ratio) {
+                degraded.push_back(i);
+                degradedPrims += subtree.end_primIndex - subtree.start_primIndex;
+            }
+        }
+
+        if (topCost > topBuiltCost * ratio || degradedPrims * 2 > prims.size()
+            || (!degraded.empty() && refitTop.empty())) {
+            build(prims);
+            return true;
+        }
+    }
+
+    if (!degraded.empty()) {
+        rebuildSubtrees(prims, degraded);
+        const vector<RefitSubtree> previous = std::move(refitSubtrees);
+        const float previousTopCost = topBuiltCost;
+        prepareRefit();
+        topBuiltCost = previousTopCost;
+        bRebuilt = true;
+
+        //the top is untouched, so the subtrees come out the same, over the same ranges;
+        //only the rebuilt ones start over from their new cost
+        for (uint32_t i = 0, d = 0; i < refitSubtrees.size() && i < previous.size(); ++i) {
+            const bool bWasRebuilt = d < degraded.size() && degraded[d] == i;
+            d += bWasRebuilt;
+            if (!bWasRebuilt && refitSubtrees[i].start_primIndex == previous[i].start_primIndex
+                && refitSubtrees[i].end_primIndex == previous[i].end_primIndex) {
+                refitSubtrees[i].builtCost = previous[i].builtCost;
+            }
+        }
+    }
+
+    wideNodes4.clear();
+    wideNodes8.clear();
+    if (config.width == 4) wideNodes4 = collapseBVH<4>(nodes);
+    else if (config.width == 8) wideNodes8 = collapseBVH<8>(nodes);
+
+    if constexpr (LeafAccel<Primitive>::bEnabled) {
+        leafAccel.build(prims, nodes, config);
+    }
+
+    return bRebuilt;
+}
+
+/*
+* each degraded subtree is built by one thread into its own array, its primitives reordered within their range;
+* local roots replace the old ones and the rest is appended as in build(),
+* then the tree is copied without the replaced nodes, children still next to each other and after their parent.
+*/
+template<RTPrimitive Primitive>
+void BVH<Primitive>::rebuildSubtrees(vector<Primitive>& prims, const vector<uint32_t>& degraded) {
+    ThreadPool& pool = config.pool ? *config.pool : ThreadPool::shared();
+
+    vector<vector<BVHNode>> subtreeNodes(degraded.size());
+    auto rebuildRange = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const RefitSubtree& subtree = refitSubtrees[degraded[i]];
+            const uint32_t first = subtree.start_primIndex;
+            const uint32_t count = subtree.end_primIndex - first;
+
+            vector<PrimRef> refs(count);
+            for (uint32_t k = 0; k < count; ++k) {
+                auto bounds = prims[first + k].getBoundingBox();
+                refs[k] = { bounds, bounds.centroid(), first + k };
+            }
+
+            auto& local = subtreeNodes[i];
+            local.reserve(count * 2);
+            buildSubtree(refs, 0, count, subtree.depth, config, local);
+            for (auto& node : local) {
+                if (node.is_leaf()) node.left_first += first;
+            }
+
+            vector<Primitive> ordered;
+            ordered.reserve(count);
+            for (auto& ref : refs) {
+                ordered.push_back(std::move(prims[ref.index]));
+            }
+            std::move(ordered.begin(), ordered.end(), prims.begin() + first);
+        }
+    };
+    if (config.bParallel) pool.parallelFor(degraded.size(), 1, rebuildRange);
+    else rebuildRange(0, degraded.size());
+
+    for (size_t i = 0; i < degraded.size(); ++i) {
+        auto& local = subtreeNodes[i];
+        const uint32_t offset = static_cast<uint32_t>(nodes.size());
+        auto relocate = [offset](const BVHNode& source) {
+            BVHNode node = source;
+            if (!node.is_leaf()) {
+                node.left_first = offset + node.left_first - 1;
+            }
+            return node;
+        };
+
+        nodes[refitSubtrees[degraded[i]].node_index] = relocate(local[0]);
+        for (size_t k = 1; k < local.size(); ++k) {
+            nodes.push_back(relocate(local[k]));
+        }
+    }
+
+    vector<BVHNode> compacted;
+    compacted.reserve(nodes.size());
+    compacted.push_back(nodes[0]);
+    for (uint32_t n = 0; n < compacted.size(); ++n) {
+        if (compacted[n].is_leaf()) continue;
+
+        const uint32_t left = compacted[n].left_first;
+        compacted[n].left_first = static_cast<uint32_t>(compacted.size());
+        compacted.push_back(nodes[left]);
+        compacted.push_back(nodes[left + 1]);
+    }
+    nodes = std::move(compacted);
+}
 
-        // Check for intersection with the primitive
-        if (auto intersection = primitive.intersect(ray); intersection.has_value() 
-			&& intersection.value().travel_t < closest_t)
-        {
-            // Update closest intersection
-			closest_t = intersection.value().travel_t;
-			closest_intersection = intersection;
+template<RTPrimitive Primitive>
+std::optional<Intersection> BVH<Primitive>::leaf_intersect(uint32_t first_prim, uint32_t prim_count, const Ray& ray, const LeafRay& leafRay, float closest_t) const {
+    if constexpr (LeafAccel<Primitive>::bEnabled) {
+        return leafAccel.intersect(primitives, first_prim, prim_count, ray, leafRay, closest_t);
+    }
+    else {
+        std::optional<Intersection> closest_intersection;
+
+        //a primitive with its own traversal (an Instance) can then stop at the closest hit so far
+        Ray clamped = ray;
+        clamped.t_max = closest_t;
+        for (uint32_t i = first_prim; i < first_prim + prim_count; ++i) {
+            const auto& primitive = primitives[i];
+
+            // Check for intersection with the primitive
+            if (auto intersection = primitive.intersect(clamped); intersection.has_value() 
+			    && intersection.value().travel_t < closest_t)
+            {
+                // Update closest intersection
+			    closest_t = intersection.value().travel_t;
+                clamped.t_max = closest_t;
+			    closest_intersection = intersection;
+                closest_intersection->primIndex = i;
+            }
         }
+
+        return closest_intersection; // Returns the closest intersection or std::nullopt if none found
     }
+}
 
-    return closest_intersection; // Returns the closest intersection or std::nullopt if none found
+//primitives with an occluded() of their own (an Instance, whose BLAS stops at its first hit) are asked that instead
+template<RTPrimitive Primitive>
+bool BVH<Primitive>::leaf_occluded(uint32_t first_prim, uint32_t prim_count, const Ray& ray, const LeafRay& leafRay, float closest_t) const {
+    if constexpr (requires(const Primitive& primitive) { { primitive.occluded(ray) } -> std::convertible_to<bool>; }) {
+        Ray clamped = ray;
+        clamped.t_max = closest_t;
+        for (uint32_t i = first_prim; i < first_prim + prim_count; ++i) {
+            if (primitives[i].occluded(clamped)) return true;
+        }
+        return false;
+    }
+    else {
+        return leaf_intersect(first_prim, prim_count, ray, leafRay, closest_t).has_value();
+    }
 }
 
 template<RTPrimitive Primitive>
 inline optional<Intersection> BVH<Primitive>::intersect(const Ray& ray) const
+{
+    if (!wideNodes8.empty()) return intersectWide<false>(wideNodes8, ray);
+    if (!wideNodes4.empty()) return intersectWide<false>(wideNodes4, ray);
+    return intersectBinary<false>(ray);
+}
+
+template<RTPrimitive Primitive>
+inline bool BVH<Primitive>::occluded(const Ray& ray) const
+{
+    if (!wideNodes8.empty()) return intersectWide<true>(wideNodes8, ray).has_value();
+    if (!wideNodes4.empty()) return intersectWide<true>(wideNodes4, ray).has_value();
+    return intersectBinary<true>(ray).has_value();
+}
+
+/*
+* ordered traversal: of two hit children the nearer is visited first, the farther is pushed with its entry distance;
+* pushed nodes entered beyond the closest hit found meanwhile are dropped on pop.
+* any-hit traversal returns an empty Intersection at the first blocked leaf, callers only read has_value().
+*/
+template<RTPrimitive Primitive>
+template<bool bAnyHit>
+inline optional<Intersection> BVH<Primitive>::intersectBinary(const Ray& ray) const
 {
     std::optional<Intersection> closest;
     float closest_t = ray.t_max;
 
-    // ʹʽջзǵݹ
-    std::vector<uint32_t> stack;
-    stack.push_back(0); // Ӹڵ㿪ʼ
-
-    while (!stack.empty()) {
-        uint32_t node_index = stack.back();
-        stack.pop_back();
-        const BVHNode& node = nodes[node_index];
+    if (nodes.empty() || AABB_intersectDistance(nodes[0].bounds_min, nodes[0].bounds_max, ray, closest_t) == MAX_SCALAR_V) {
+        return closest;
+    }
 
-        // ǷýڵİΧཻ
-        if (!AABB_intersect(node.bounds, ray)) {
-            //cout << "miss AABB" << '\n';
-            continue;
-        } 
-
-        if (node.is_leaf()) {
-			// Ҷӽڵ㣬 
-			//cout << "hit leaf" << '\n';
-            if (auto intersection = leaf_intersect(node, ray); intersection.has_value() 
-                && intersection.value().travel_t < closest_t)
-            { 
+    struct StackEntry {
+        uint32_t node_index;
+        float t_enter;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+
+    const LeafRay leafRay(ray);
+    const BVHNode* node = &nodes[0];
+    while (true) {
+        if (node->is_leaf()) {
+            if constexpr (bAnyHit) {
+                if (leaf_occluded(node->left_first, node->prim_count, ray, leafRay, closest_t)) return Intersection{};
+            }
+            else if (auto intersection = leaf_intersect(node->left_first, node->prim_count, ray, leafRay, closest_t); intersection.has_value())
+            {
                 // Update the closest intersection
                 closest_t = intersection.value().travel_t;
                 closest = intersection;
-            }  
+            }
         }
         else {
-            //cout << "hit internal" << '\n';
-            // ڲڵ㣬ӽڵѹջ
-			auto left_child = node.as_internal().left_child;
-            stack.push_back(left_child);
-            stack.push_back(left_child + 1);
+            uint32_t near_index = node->left_first;
+            uint32_t far_index = near_index + 1;
+            float t_near = AABB_intersectDistance(nodes[near_index].bounds_min, nodes[near_index].bounds_max, ray, closest_t);
+            float t_far = AABB_intersectDistance(nodes[far_index].bounds_min, nodes[far_index].bounds_max, ray, closest_t);
+            if (t_far < t_near) {
+                std::swap(near_index, far_index);
+                std::swap(t_near, t_far);
+            }
+
+            if (t_near != MAX_SCALAR_V) {
+                if (t_far != MAX_SCALAR_V) {
+                    stack[stack_size++] = { far_index, t_far };
+                }
+                node = &nodes[near_index];
+                continue;
+            }
         }
+
+        //pop the next node still in front of the closest hit
+        node = nullptr;
+        while (stack_size > 0) {
+            const StackEntry& entry = stack[--stack_size];
+            if (entry.t_enter < closest_t) {
+                node = &nodes[entry.node_index];
+                break;
+            }
+        }
+        if (!node) break;
     }
 
     return closest; 
 
 }
 
- 
\ No newline at end of file
+/*
+* hit children are pushed farthest first, so the nearest is popped next;
+* leaves go on the stack like nodes and are tested when popped, unless a closer hit came first.
+* any-hit traversal returns an empty Intersection at the first blocked leaf.
+*/
+template<RTPrimitive Primitive>
+template<bool bAnyHit, uint32_t Width>
+inline optional<Intersection> BVH<Primitive>::intersectWide(const vector<BVHWideNode<Width>>& wideNodes, const Ray& ray) const
+{
+    return traverseWide<bAnyHit>(wideNodes, ray, WideRay(ray), LeafRay(ray), ray.t_max, 0, 0);
+}
+
+template<RTPrimitive Primitive>
+template<bool bAnyHit, uint32_t Width>
+inline optional<Intersection> BVH<Primitive>::traverseWide(const vector<BVHWideNode<Width>>& wideNodes, const Ray& ray, const WideRay& wideRay,
+    const LeafRay& leafRay, float closest_t, uint32_t root_child, uint32_t root_count) const
+{
+    std::optional<Intersection> closest;
+
+    struct StackEntry {
+        uint32_t child;
+        uint32_t count;
+        float t_enter;
+    };
+    //a node pushes at most Width - 1 more entries than it pops
+    StackEntry stack[BVH_MAX_DEPTH * (Width - 1) + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = { root_child, root_count, -MAX_SCALAR_V };
+
+    while (stack_size > 0) {
+        const StackEntry entry = stack[--stack_size];
+        if (entry.t_enter >= closest_t) continue;
+
+        if (entry.count != 0) {
+            if constexpr (bAnyHit) {
+                if (leaf_occluded(entry.child, entry.count, ray, leafRay, closest_t)) return Intersection{};
+            }
+            else if (auto intersection = leaf_intersect(entry.child, entry.count, ray, leafRay, closest_t); intersection.has_value())
+            {
+                closest_t = intersection.value().travel_t;
+                closest = intersection;
+            }
+            continue;
+        }
+
+        const BVHWideNode<Width>& node = wideNodes[entry.child];
+        alignas(32) float t_enter[Width];
+        uint32_t mask = intersectChildren(node, wideRay, closest_t, t_enter);
+
+        //insertion sort by distance, farthest first
+        StackEntry hits[Width];
+        uint32_t hit_count = 0;
+        while (mask) {
+            uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+            mask &= mask - 1;
+
+            StackEntry hit{ node.child[i], node.count[i], t_enter[i] };
+            uint32_t j = hit_count++;
+            while (j > 0 && hits[j - 1].t_enter < hit.t_enter) {
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = hit;
+        }
+
+        for (uint32_t i = 0; i < hit_count; ++i) {
+            stack[stack_size++] = hits[i];
+        }
+    }
+
+    return closest;
+}
+
+/*
+* a leaf for the lanes in mask: primitives with a packet path of their own (an Instance) take the lanes together,
+* the others are tested lane by lane.
+*/
+template<RTPrimitive Primitive>
+template<bool bAnyHit, uint32_t Size>
+inline uint32_t BVH<Primitive>::packetLeaf(uint32_t first_prim, uint32_t prim_count, const RayPacket<Size>& packet, uint32_t mask,
+    const LeafRay* leafRays, float* closest_t, optional<Intersection>* hits) const
+{
+    uint32_t hit_mask = 0;
+    if constexpr (requires(const Primitive& primitive) { primitive.template tracePacket<bAnyHit>(packet, mask, closest_t, hits); }) {
+        for (uint32_t i = first_prim; i < first_prim + prim_count && mask; ++i) {
+            const uint32_t lanes = primitives[i].template tracePacket<bAnyHit>(packet, mask, closest_t, hits);
+            hit_mask |= lanes;
+            if constexpr (bAnyHit) {
+                mask &= ~lanes;
+            }
+            else {
+                for (uint32_t hit = lanes; hit; hit &= hit - 1) hits[std::countr_zero(hit)]->primIndex = i;
+            }
+        }
+    }
+    else {
+        for (uint32_t lanes = mask; lanes; lanes &= lanes - 1) {
+            const uint32_t lane = static_cast<uint32_t>(std::countr_zero(lanes));
+            if constexpr (bAnyHit) {
+                if (leaf_occluded(first_prim, prim_count, *packet.rays[lane], leafRays[lane], closest_t[lane])) hit_mask |= 1u << lane;
+            }
+            else if (auto intersection = leaf_intersect(first_prim, prim_count, *packet.rays[lane], leafRays[lane], closest_t[lane]); intersection.has_value()) {
+                closest_t[lane] = intersection.value().travel_t;
+                hits[lane] = intersection;
+                hit_mask |= 1u << lane;
+            }
+        }
+    }
+    return hit_mask;
+}
+
+//with only a few lanes left the per-lane test alone is cheaper than the frustum test
+constexpr int MIN_FRUSTUM_LANES = 4;
+//and with fewer still, the lanes finish the subtree one by one on the single-ray path
+constexpr int MIN_PACKET_LANES = 2;
+
+/*
+* packet traversal over the binary nodes: a node is visited with the mask of lanes that hit it.
+* children are rejected for the whole packet by the frustum test first, then tested per lane;
+* the child with the nearest entering lane is visited first.
+* any-hit traversal retires a lane at its first hit and stops once every lane is blocked.
+*/
+template<RTPrimitive Primitive>
+template<bool bAnyHit, uint32_t Size>
+inline uint32_t BVH<Primitive>::traversePacket(const RayPacket<Size>& packet, uint32_t valid, float* closest_t, optional<Intersection>* hits) const
+{
+    uint32_t hit_mask = 0;
+
+    //farthest any lane may still hit, only shrinks after a leaf
+    float packet_t_max = -MAX_SCALAR_V;
+    auto updatePacketTMax = [&]() {
+        packet_t_max = -MAX_SCALAR_V;
+        for (uint32_t lanes = bAnyHit ? valid & ~hit_mask : valid; lanes; lanes &= lanes - 1) {
+            packet_t_max = std::max(packet_t_max, closest_t[std::countr_zero(lanes)]);
+        }
+    };
+    updatePacketTMax();
+
+    auto testNode = [&](const BVHNode& node, uint32_t mask, float& min_enter) -> uint32_t {
+        if (std::popcount(mask) >= MIN_FRUSTUM_LANES && frustumMisses(node.bounds_min, node.bounds_max, packet, packet_t_max)) return 0;
+        return intersectPacketBox(node.bounds_min, node.bounds_max, packet, closest_t, mask, min_enter);
+    };
+
+    if (nodes.empty() || valid == 0) return 0;
+
+    LeafRay leafRays[Size];
+    for (uint32_t lanes = valid; lanes; lanes &= lanes - 1) {
+        const uint32_t lane = static_cast<uint32_t>(std::countr_zero(lanes));
+        leafRays[lane] = LeafRay(*packet.rays[lane]);
+    }
+
+    float root_enter;
+    uint32_t mask = testNode(nodes[0], valid, root_enter);
+    if (!mask) return 0;
+
+    struct StackEntry {
+        uint32_t node_index;
+        uint32_t mask;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+
+    const BVHNode* node = &nodes[0];
+    while (true) {
+        if (node->is_leaf()) {
+            hit_mask |= packetLeaf<bAnyHit>(node->left_first, node->prim_count, packet, mask, leafRays, closest_t, hits);
+
+            if constexpr (bAnyHit) {
+                if (hit_mask == valid) break;
+            }
+            updatePacketTMax();
+        }
+        else {
+            uint32_t near_index = node->left_first;
+            uint32_t far_index = near_index + 1;
+            float t_near, t_far;
+            uint32_t near_mask = testNode(nodes[near_index], mask, t_near);
+            uint32_t far_mask = testNode(nodes[far_index], mask, t_far);
+            if (near_mask && far_mask && t_far < t_near) {
+                std::swap(near_index, far_index);
+                std::swap(near_mask, far_mask);
+            }
+            else if (!near_mask) {
+                near_index = far_index;
+                near_mask = far_mask;
+                far_mask = 0;
+            }
+
+            if (near_mask) {
+                if (far_mask) {
+                    stack[stack_size++] = { far_index, far_mask };
+                }
+                node = &nodes[near_index];
+                mask = near_mask;
+                continue;
+            }
+        }
+
+        //lanes blocked meanwhile no longer need the popped node
+        node = nullptr;
+        while (stack_size > 0) {
+            const StackEntry& entry = stack[--stack_size];
+            mask = bAnyHit ? entry.mask & ~hit_mask : entry.mask;
+            if (mask) {
+                node = &nodes[entry.node_index];
+                break;
+            }
+        }
+        if (!node) break;
+    }
+
+    return hit_mask;
+}
+
+/*
+* packet traversal over the wide nodes, ordered like intersectWide: hit children are pushed farthest first,
+* each with the lanes that hit it and the nearest of their entries.
+* a coherent packet first culls the node's children all at once by the frustum test, the survivors are tested per lane.
+* an entry popped beyond every lane's closest hit is dropped, as are lanes blocked meanwhile;
+* one reached by fewer than MIN_PACKET_LANES lanes is left to traverseWide per lane, which orders by each ray's own hits.
+*/
+template<RTPrimitive Primitive>
+template<bool bAnyHit, uint32_t Width, uint32_t Size>
+inline uint32_t BVH<Primitive>::traversePacketWide(const vector<BVHWideNode<Width>>& wideNodes, const RayPacket<Size>& packet,
+    uint32_t valid, float* closest_t, optional<Intersection>* hits) const
+{
+    uint32_t hit_mask = 0;
+    if (valid == 0) return 0;
+
+    float packet_t_max = -MAX_SCALAR_V;
+    auto updatePacketTMax = [&]() {
+        packet_t_max = -MAX_SCALAR_V;
+        for (uint32_t lanes = bAnyHit ? valid & ~hit_mask : valid; lanes; lanes &= lanes - 1) {
+            packet_t_max = std::max(packet_t_max, closest_t[std::countr_zero(lanes)]);
+        }
+    };
+    updatePacketTMax();
+
+    LeafRay leafRays[Size];
+    WideRay wideRays[Size];
+    for (uint32_t lanes = valid; lanes; lanes &= lanes - 1) {
+        const uint32_t lane = static_cast<uint32_t>(std::countr_zero(lanes));
+        leafRays[lane] = LeafRay(*packet.rays[lane]);
+        wideRays[lane] = WideRay(*packet.rays[lane]);
+    }
+
+    struct StackEntry {
+        uint32_t child;
+        uint32_t count;
+        uint32_t mask;
+        float t_enter;
+    };
+    StackEntry stack[BVH_MAX_DEPTH * (Width - 1) + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = { 0, 0, valid, -MAX_SCALAR_V };
+
+    while (stack_size > 0) {
+        const StackEntry entry = stack[--stack_size];
+        const uint32_t mask = bAnyHit ? entry.mask & ~hit_mask : entry.mask;
+        if (!mask || entry.t_enter >= packet_t_max) continue;
+
+        if (std::popcount(mask) < MIN_PACKET_LANES) {
+            for (uint32_t lanes = mask; lanes; lanes &= lanes - 1) {
+                const uint32_t lane = static_cast<uint32_t>(std::countr_zero(lanes));
+                auto intersection = traverseWide<bAnyHit>(wideNodes, *packet.rays[lane], wideRays[lane], leafRays[lane],
+                    closest_t[lane], entry.child, entry.count);
+                if (!intersection.has_value()) continue;
+
+                hit_mask |= 1u << lane;
+                if constexpr (!bAnyHit) {
+                    closest_t[lane] = intersection.value().travel_t;
+                    hits[lane] = intersection;
+                }
+            }
+            if constexpr (bAnyHit) {
+                if (hit_mask == valid) break;
+            }
+            updatePacketTMax();
+            continue;
+        }
+
+        if (entry.count != 0) {
+            const uint32_t lanes = packetLeaf<bAnyHit>(entry.child, entry.count, packet, mask, leafRays, closest_t, hits);
+            if (!lanes) continue;
+
+            hit_mask |= lanes;
+            if constexpr (bAnyHit) {
+                if (hit_mask == valid) break;
+            }
+            updatePacketTMax();
+            continue;
+        }
+
+        const BVHWideNode<Width>& node = wideNodes[entry.child];
+        uint32_t children = (1u << Width) - 1;
+        if (packet.bCoherent && std::popcount(mask) >= MIN_FRUSTUM_LANES) {
+            children = frustumChildren(node, packet, packet_t_max);
+            if (!children) continue;
+        }
+
+        //whichever takes fewer slab tests: a child against 4 lanes at a time, or a lane against all children at once
+        uint32_t child_lanes[Width] = {};
+        float child_enter[Width];
+        uint32_t lane_groups = 0;
+        for (uint32_t group = 0; group < Size; group += 4) lane_groups += ((mask >> group) & 0xF) != 0;
+
+        if (static_cast<uint32_t>(std::popcount(children)) * lane_groups <= static_cast<uint32_t>(std::popcount(mask))) {
+            for (uint32_t rest = children; rest; rest &= rest - 1) {
+                const uint32_t i = static_cast<uint32_t>(std::countr_zero(rest));
+                child_lanes[i] = intersectPacketBox(vec3(node.min_x[i], node.min_y[i], node.min_z[i]),
+                    vec3(node.max_x[i], node.max_y[i], node.max_z[i]), packet, closest_t, mask, child_enter[i]);
+            }
+        }
+        else {
+            std::fill_n(child_enter, Width, MAX_SCALAR_V);
+            for (uint32_t lanes = mask; lanes; lanes &= lanes - 1) {
+                const uint32_t lane = static_cast<uint32_t>(std::countr_zero(lanes));
+                alignas(32) float t_enter[Width];
+                for (uint32_t hit = intersectChildren(node, wideRays[lane], closest_t[lane], t_enter) & children; hit; hit &= hit - 1) {
+                    const uint32_t i = static_cast<uint32_t>(std::countr_zero(hit));
+                    child_lanes[i] |= 1u << lane;
+                    child_enter[i] = std::min(child_enter[i], t_enter[i]);
+                }
+            }
+        }
+
+        //insertion sort by the nearest entering lane, farthest first
+        StackEntry hit_children[Width];
+        uint32_t hit_count = 0;
+        for (uint32_t i = 0; i < Width; ++i) {
+            if (!child_lanes[i]) continue;
+
+            StackEntry hit{ node.child[i], node.count[i], child_lanes[i], child_enter[i] };
+            uint32_t j = hit_count++;
+            while (j > 0 && hit_children[j - 1].t_enter < hit.t_enter) {
+                hit_children[j] = hit_children[j - 1];
+                --j;
+            }
+            hit_children[j] = hit;
+        }
+
+        for (uint32_t i = 0; i < hit_count; ++i) {
+            stack[stack_size++] = hit_children[i];
+        }
+    }
+
+    return hit_mask;
+}
+
+template<RTPrimitive Primitive>
+template<bool bAnyHit, uint32_t Size>
+inline uint32_t BVH<Primitive>::tracePacket(const RayPacket<Size>& packet, uint32_t mask, float* closest_t, optional<Intersection>* hits) const
+{
+    if (!wideNodes8.empty()) return traversePacketWide<bAnyHit>(wideNodes8, packet, mask, closest_t, hits);
+    if (!wideNodes4.empty()) return traversePacketWide<bAnyHit>(wideNodes4, packet, mask, closest_t, hits);
+    return traversePacket<bAnyHit>(packet, mask, closest_t, hits);
+}
+
+template<RTPrimitive Primitive>
+template<uint32_t Size>
+inline array<optional<Intersection>, Size> BVH<Primitive>::intersect(const RayPacket<Size>& packet) const
+{
+    array<optional<Intersection>, Size> hits;
+    alignas(32) float closest_t[Size];
+    std::copy(packet.t_max, packet.t_max + Size, closest_t);
+    tracePacket<false>(packet, packet.validMask(), closest_t, hits.data());
+    return hits;
+}
+
+template<RTPrimitive Primitive>
+template<uint32_t Size>
+inline uint32_t BVH<Primitive>::occluded(const RayPacket<Size>& packet) const
+{
+    alignas(32) float closest_t[Size];
+    std::copy(packet.t_max, packet.t_max + Size, closest_t);
+    return tracePacket<true>(packet, packet.validMask(), closest_t, nullptr);
+}
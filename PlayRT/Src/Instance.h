@@ -0,0 +1,131 @@
+#pragma once
+
+#include <memory>
+
+#include "Math.h"
+#include "Ray.h"
+#include "BVH.h"
+#include "Triangle.h"
+
+using namespace std;
+
+
+/*
+* a TriangleMesh placed in the world. the mesh and its BLAS stay in object space, shared by every instance of it;
+* rays are taken into object space instead, the direction not renormalized so t is the same in both spaces.
+* the scene's TLAS is a BVH over instances: moving one is setTransform() and a TLAS rebuild, its BLAS is untouched.
+*/
+class Instance : IRTPrimitive {
+public:
+	Instance() = delete;
+	Instance(shared_ptr<const TriangleMesh> mesh, const mat4& transform = mat4(1.0f)) : mesh(std::move(mesh)) {
+		setTransform(transform);
+	}
+
+	void setTransform(const mat4& transform) {
+		objectToWorld = transform;
+		worldToObject = glm::inverse(transform);
+		normalToWorld = glm::transpose(mat3(worldToObject));
+		bIdentity = transform == mat4(1.0f);
+		updateBounds();
+	}
+
+	//the world bounds of the 8 corners of the object bounds, again once the mesh was refit
+	void updateBounds() {
+		bounds = Bounds3{};
+		const Bounds3 local = mesh->getBoundingBox();
+		if (local.min.x > local.max.x) return;
+		for (uint32_t corner = 0; corner < 8; ++corner) {
+			bounds.grow(toWorld(vec3(
+				corner & 1 ? local.max.x : local.min.x,
+				corner & 2 ? local.max.y : local.min.y,
+				corner & 4 ? local.max.z : local.min.z)));
+		}
+	}
+
+	const mat4& getTransform() const { return objectToWorld; }
+	const TriangleMesh& getMesh() const { return *mesh; }
+
+	vec3 toWorld(const vec3& p) const {
+		return vec3(objectToWorld * vec4(p, 1.0f));
+	}
+
+	//triangle meshPrimIndex of the mesh, in world space
+	Triangle worldTriangle(uint32_t meshPrimIndex) const {
+		const Triangle& triangle = mesh->triangles[meshPrimIndex];
+		return Triangle(Vertex{ toWorld(triangle.v0.position) }, Vertex{ toWorld(triangle.v1.position) },
+			Vertex{ toWorld(triangle.v2.position) }, triangle.materialId);
+	}
+
+	virtual Bounds3 getBoundingBox() const override {
+		return bounds;
+	}
+
+	virtual optional<Intersection> intersect(const Ray& ray) const override
+	{
+		auto hit = bIdentity ? mesh->intersect(ray) : mesh->intersect(toObject(ray));
+		if (!hit.has_value()) return nullopt;
+
+		hit->meshPrimIndex = hit->primIndex;
+		if (bIdentity) return hit;
+
+		hit->position = ray.origin + ray.direction * hit->travel_t;
+		hit->normal = normalize(normalToWorld * hit->normal);
+		return hit;
+	}
+
+	bool occluded(const Ray& ray) const
+	{
+		return bIdentity ? mesh->occluded(ray) : mesh->occluded(toObject(ray));
+	}
+
+	//the TLAS hands its packet on to the BLAS, see BVH::tracePacket; closest_t carries over as t is the same in both spaces
+	template<bool bAnyHit, uint32_t Size>
+	uint32_t tracePacket(const RayPacket<Size>& packet, uint32_t mask, float* closest_t, optional<Intersection>* hits) const
+	{
+		if (bIdentity) {
+			const uint32_t lanes = mesh->blas.template tracePacket<bAnyHit>(packet, mask, closest_t, hits);
+			if constexpr (!bAnyHit) {
+				for (uint32_t hit = lanes; hit; hit &= hit - 1) {
+					auto& intersection = hits[std::countr_zero(hit)];
+					intersection->meshPrimIndex = intersection->primIndex;
+				}
+			}
+			return lanes;
+		}
+
+		optional<Ray> localRays[Size];
+		RayPacket<Size> local;
+		for (uint32_t lane = 0; lane < packet.count; ++lane) {
+			local.add(localRays[lane].emplace(toObject(*packet.rays[lane])));
+		}
+		local.finalize();
+
+		const uint32_t lanes = mesh->blas.template tracePacket<bAnyHit>(local, mask, closest_t, hits);
+		if constexpr (!bAnyHit) {
+			for (uint32_t hit = lanes; hit; hit &= hit - 1) {
+				const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hit));
+				const Ray& ray = *packet.rays[lane];
+				auto& intersection = hits[lane];
+				intersection->meshPrimIndex = intersection->primIndex;
+				intersection->position = ray.origin + ray.direction * intersection->travel_t;
+				intersection->normal = normalize(normalToWorld * intersection->normal);
+			}
+		}
+		return lanes;
+	}
+
+private:
+	Ray toObject(const Ray& ray) const {
+		Ray local(vec3(worldToObject * vec4(ray.origin, 1.0f)), mat3(worldToObject) * ray.direction);
+		local.t_max = ray.t_max;
+		return local;
+	}
+
+	shared_ptr<const TriangleMesh> mesh;
+	mat4 objectToWorld;
+	mat4 worldToObject;
+	mat3 normalToWorld;   //inverse transpose of the linear part
+	bool bIdentity = true;  //the loose triangles: rays go to the BLAS as they are
+	Bounds3 bounds;
+};
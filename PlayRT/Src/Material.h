@@ -1,8 +1,211 @@
 #pragma once
 
+#include <cstdint>
+#include <cmath>
+#include <optional>
+
 #include "Math.h"
+#include "Sampling.h"
+
+using namespace std;
+
+
+enum class MaterialType : uint32_t {
+    Lambertian,
+    GGX,
+    Dielectric,
+};
+
+/*
+* Lambertian: albedo is the diffuse reflectance.
+* GGX: rough conductor, albedo is the normal-incidence reflectance F0 of Schlick's Fresnel, alpha = roughness^2.
+* Dielectric: smooth glass of index ior, albedo tints reflection and transmission alike.
+* any material with emission is a light; emitters shine from both faces.
+*/
+struct Material {
+    MaterialType type = MaterialType::Lambertian;
+    vec3 albedo{ 0.8f };
+    vec3 emission{ 0.0f };
+    float roughness = 0.5f;
+    float ior = 1.5f;
+
+    static Material lambertian(const vec3& albedo) {
+        Material material;
+        material.albedo = albedo;
+        return material;
+    }
+
+    static Material ggx(const vec3& f0, float roughness) {
+        Material material;
+        material.type = MaterialType::GGX;
+        material.albedo = f0;
+        material.roughness = roughness;
+        return material;
+    }
+
+    static Material dielectric(float ior, const vec3& tint = vec3(1.0f)) {
+        Material material;
+        material.type = MaterialType::Dielectric;
+        material.albedo = tint;
+        material.ior = ior;
+        return material;
+    }
+
+    static Material emissive(const vec3& emission, const vec3& albedo = vec3(0.0f)) {
+        Material material;
+        material.albedo = albedo;
+        material.emission = emission;
+        return material;
+    }
+
+    bool isEmissive() const { return emission.x > 0.0f || emission.y > 0.0f || emission.z > 0.0f; }
+
+    //only reflects or refracts into single directions: nothing for light sampling to do
+    bool isDelta() const { return type == MaterialType::Dielectric; }
+};
+
+
+struct BSDFSample {
+    vec3 wi;
+    vec3 weight;        //f * |cos wi| / pdf
+    float pdf = 0.0f;   //solid angle; 0 for delta lobes
+    bool bDelta = false;
+};
+
+
+/*
+* GGX with Smith's height-correlated masking, local frame with the normal as z.
+* directions are sampled from the visible normals (Heitz 2018), so the weight is F * G2 / G1(wo).
+*/
+inline float ggxAlpha(float roughness) {
+    return std::max(roughness * roughness, 1e-3f);
+}
+
+inline float ggxD(const vec3& h, float alpha) {
+    const float a2 = alpha * alpha;
+    const float d = h.z * h.z * (a2 - 1.0f) + 1.0f;
+    return a2 / (PI * d * d);
+}
+
+inline float ggxLambda(const vec3& w, float alpha) {
+    const float cos2 = w.z * w.z;
+    if (cos2 <= 0.0f) return 0.0f;
+    const float tan2 = std::max(0.0f, 1.0f - cos2) / cos2;
+    return 0.5f * (std::sqrt(1.0f + alpha * alpha * tan2) - 1.0f);
+}
+
+inline vec3 schlickFresnel(const vec3& f0, float cosTheta) {
+    const float m = std::clamp(1.0f - cosTheta, 0.0f, 1.0f);
+    const float m2 = m * m;
+    return f0 + (vec3(1.0f) - f0) * (m2 * m2 * m);
+}
+
+inline vec3 sampleGGXVisibleNormal(const vec3& wo, float alpha, const vec2& u) {
+    const vec3 vh = normalize(vec3(alpha * wo.x, alpha * wo.y, wo.z));
+    const float lensq = vh.x * vh.x + vh.y * vh.y;
+    const vec3 t1 = lensq > 0.0f ? vec3(-vh.y, vh.x, 0.0f) / std::sqrt(lensq) : vec3(1.0f, 0.0f, 0.0f);
+    const vec3 t2 = glm::cross(vh, t1);
+
+    const float r = std::sqrt(u.x);
+    const float phi = 2.0f * PI * u.y;
+    const float p1 = r * std::cos(phi);
+    const float s = 0.5f * (1.0f + vh.z);
+    const float p2 = (1.0f - s) * std::sqrt(std::max(0.0f, 1.0f - p1 * p1)) + s * r * std::sin(phi);
+
+    const vec3 nh = t1 * p1 + t2 * p2 + vh * std::sqrt(std::max(0.0f, 1.0f - p1 * p1 - p2 * p2));
+    return normalize(vec3(alpha * nh.x, alpha * nh.y, std::max(1e-6f, nh.z)));
+}
+
+//unpolarized Fresnel reflectance; eta = ior on the far side / ior on the near side
+inline float dielectricFresnel(float cosThetaI, float eta, float& cosThetaT) {
+    const float sin2T = (1.0f - cosThetaI * cosThetaI) / (eta * eta);
+    if (sin2T >= 1.0f) {
+        cosThetaT = 0.0f;
+        return 1.0f;
+    }
+    cosThetaT = std::sqrt(1.0f - sin2T);
+    const float rs = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+    const float rp = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+    return 0.5f * (rs * rs + rp * rp);
+}
+
+
+/*
+* wo points away from the surface, normal is the geometric one in either orientation.
+* opaque materials are two-sided; a dielectric is entered from the side its normal faces.
+*/
+
+//f * |cos wi| for wi, and the pdf sampleBSDF picks wi with; zero for delta materials
+inline vec3 evalBSDF(const Material& material, const vec3& normal, const vec3& wo, const vec3& wi, float& pdf) {
+    pdf = 0.0f;
+    if (material.isDelta()) return vec3(0.0f);
+
+    const Frame frame(glm::dot(wo, normal) < 0.0f ? -normal : normal);
+    const vec3 o = frame.toLocal(wo), i = frame.toLocal(wi);
+    if (o.z <= 0.0f || i.z <= 0.0f) return vec3(0.0f);
+
+    if (material.type == MaterialType::Lambertian) {
+        pdf = i.z / PI;
+        return material.albedo * (i.z / PI);
+    }
+
+    const float alpha = ggxAlpha(material.roughness);
+    const vec3 h = normalize(o + i);
+    const float d = ggxD(h, alpha);
+    const float lambda_o = ggxLambda(o, alpha), lambda_i = ggxLambda(i, alpha);
+    const float g1 = 1.0f / (1.0f + lambda_o);
+    const float g2 = 1.0f / (1.0f + lambda_o + lambda_i);
+
+    pdf = g1 * d / (4.0f * o.z);
+    return schlickFresnel(material.albedo, glm::dot(i, h)) * (d * g2 / (4.0f * o.z));
+}
+
+//u picks the direction, uc the lobe of a dielectric
+inline optional<BSDFSample> sampleBSDF(const Material& material, const vec3& normal, const vec3& wo, const vec2& u, float uc) {
+    if (material.type == MaterialType::Dielectric) {
+        const float cosO = glm::dot(wo, normal);
+        const bool bEntering = cosO > 0.0f;
+        const vec3 n = bEntering ? normal : -normal;
+        const float eta = bEntering ? material.ior : 1.0f / material.ior;
+
+        float cosT;
+        const float cosI = std::abs(cosO);
+        const float reflectance = dielectricFresnel(cosI, eta, cosT);
+
+        BSDFSample sample;
+        sample.bDelta = true;
+        sample.weight = material.albedo;
+        if (uc < reflectance) {
+            sample.wi = n * (2.0f * cosI) - wo;
+        }
+        else {
+            sample.wi = normalize(-wo / eta + n * (cosI / eta - cosT));
+        }
+        return sample;
+    }
+
+    const Frame frame(glm::dot(wo, normal) < 0.0f ? -normal : normal);
+    const vec3 o = frame.toLocal(wo);
+    if (o.z <= 0.0f) return nullopt;
 
+    BSDFSample sample;
+    if (material.type == MaterialType::Lambertian) {
+        const vec3 i = sampleCosineHemisphere(u);
+        if (i.z <= 0.0f) return nullopt;
+        sample.wi = frame.toWorld(i);
+        sample.pdf = i.z / PI;
+        sample.weight = material.albedo;
+        return sample;
+    }
 
-class Material {
+    const float alpha = ggxAlpha(material.roughness);
+    const vec3 h = sampleGGXVisibleNormal(o, alpha, u);
+    const vec3 i = h * (2.0f * glm::dot(o, h)) - o;
+    if (i.z <= 0.0f) return nullopt;
 
-};
\ No newline at end of file
+    const float lambda_o = ggxLambda(o, alpha), lambda_i = ggxLambda(i, alpha);
+    sample.wi = frame.toWorld(i);
+    sample.pdf = ggxD(h, alpha) / ((1.0f + lambda_o) * 4.0f * o.z);
+    sample.weight = schlickFresnel(material.albedo, glm::dot(i, h)) * ((1.0f + lambda_o) / (1.0f + lambda_o + lambda_i));
+    return sample;
+}
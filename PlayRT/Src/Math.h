@@ -11,10 +11,15 @@ using Scalar_t = float;
 
 using vec3 = glm::vec3;
 using vec2 = glm::vec2;
+using vec4 = glm::vec4;
+using mat3 = glm::mat3;
+using mat4 = glm::mat4;
 
 constexpr Scalar_t MAX_SCALAR_V = std::numeric_limits<Scalar_t>::max();
 constexpr Scalar_t MIN_SCALAR_V = std::numeric_limits<Scalar_t>::min();
 
+constexpr float EPSILON = 1e-6f;
+
 
 constexpr Scalar_t PI = 3.14159265358979323846f;
 
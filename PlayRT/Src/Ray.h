@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Math.h"
+#include <cstdint>
 #include <optional>
 
 struct Ray {
@@ -24,6 +25,11 @@ struct Intersection {
 	vec3 position;
 	vec3 normal;
 	float travel_t;
+
+	//set by the BVH: which of its primitives was hit
+	uint32_t primIndex = 0;
+	//set by an Instance: the triangle of its mesh, primIndex being the instance
+	uint32_t meshPrimIndex = 0;
 };
 
  
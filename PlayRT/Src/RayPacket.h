@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+
+#include "Math.h"
+#include "Ray.h"
+#include "WideBVH.h"
+
+
+using namespace std;
+
+
+/*
+* Size rays traced through the BVH together, laid out per component for SIMD box tests.
+* a packet is sign-coherent when every ray has the same direction sign on each axis;
+* only then can a node be rejected for the whole packet by interval arithmetic (the frustum test).
+* lanes past count are copies of lane 0 and always masked off.
+* the packet points at the rays added to it, they must outlive it.
+*/
+template<uint32_t Size>
+struct RayPacket {
+    static_assert(Size == 4 || Size == 8 || Size == 16, "packets hold 4, 8 or 16 rays");
+
+    void add(const Ray& ray) {
+        const uint32_t lane = count++;
+        origin_x[lane] = ray.origin.x;
+        origin_y[lane] = ray.origin.y;
+        origin_z[lane] = ray.origin.z;
+        invDir_x[lane] = ray.invertDir.x;
+        invDir_y[lane] = ray.invertDir.y;
+        invDir_z[lane] = ray.invertDir.z;
+        t_max[lane] = ray.t_max;
+        rays[lane] = &ray;
+    }
+
+    bool full() const { return count == Size; }
+
+    uint32_t validMask() const { return (1u << count) - 1; }
+
+    //call once all rays are added
+    void finalize() {
+        for (uint32_t lane = count; lane < Size; ++lane) {
+            origin_x[lane] = origin_x[0];
+            origin_y[lane] = origin_y[0];
+            origin_z[lane] = origin_z[0];
+            invDir_x[lane] = invDir_x[0];
+            invDir_y[lane] = invDir_y[0];
+            invDir_z[lane] = invDir_z[0];
+            t_max[lane] = t_max[0];
+        }
+
+        bCoherent = count > 0;
+        const float* origins[3] = { origin_x, origin_y, origin_z };
+        const float* invDirs[3] = { invDir_x, invDir_y, invDir_z };
+        for (int axis = 0; axis < 3; ++axis) {
+            originMin[axis] = invDirMin[axis] = MAX_SCALAR_V;
+            originMax[axis] = invDirMax[axis] = -MAX_SCALAR_V;
+            for (uint32_t lane = 0; lane < count; ++lane) {
+                originMin[axis] = std::min(originMin[axis], origins[axis][lane]);
+                originMax[axis] = std::max(originMax[axis], origins[axis][lane]);
+                invDirMin[axis] = std::min(invDirMin[axis], invDirs[axis][lane]);
+                invDirMax[axis] = std::max(invDirMax[axis], invDirs[axis][lane]);
+            }
+
+            //axis-parallel rays have infinite inverses, the interval products would turn into NaN
+            if (!std::isfinite(invDirMin[axis]) || !std::isfinite(invDirMax[axis])
+                || (invDirMin[axis] < 0) != (invDirMax[axis] < 0)) {
+                bCoherent = false;
+            }
+        }
+    }
+
+    alignas(32) float origin_x[Size], origin_y[Size], origin_z[Size];
+    alignas(32) float invDir_x[Size], invDir_y[Size], invDir_z[Size];
+    alignas(32) float t_max[Size];
+
+    //the primitives take whole rays
+    const Ray* rays[Size];
+    uint32_t count = 0;
+
+    bool bCoherent = false;
+    float originMin[3], originMax[3];
+    float invDirMin[3], invDirMax[3];
+};
+
+
+inline void intervalProduct(float a0, float a1, float b0, float b1, float& lo, float& hi) {
+    float p0 = a0 * b0, p1 = a0 * b1, p2 = a1 * b0, p3 = a1 * b1;
+    lo = std::min(std::min(p0, p1), std::min(p2, p3));
+    hi = std::max(std::max(p0, p1), std::max(p2, p3));
+}
+
+/*
+* conservative: true only if no ray of the packet can enter the box before t_max.
+* bounds every ray's entry from below and exit from above over the origin and inverse direction intervals.
+*/
+template<uint32_t Size>
+inline bool frustumMisses(const vec3& bounds_min, const vec3& bounds_max, const RayPacket<Size>& packet, float t_max) {
+    if (!packet.bCoherent) return false;
+
+    float enter = -MAX_SCALAR_V, exit = MAX_SCALAR_V;
+    for (int axis = 0; axis < 3; ++axis) {
+        const bool bPositive = packet.invDirMin[axis] >= 0;
+        const float near_plane = bPositive ? bounds_min[axis] : bounds_max[axis];
+        const float far_plane = bPositive ? bounds_max[axis] : bounds_min[axis];
+
+        float lo, hi;
+        intervalProduct(near_plane - packet.originMax[axis], near_plane - packet.originMin[axis],
+            packet.invDirMin[axis], packet.invDirMax[axis], lo, hi);
+        enter = std::max(enter, lo);
+
+        intervalProduct(far_plane - packet.originMax[axis], far_plane - packet.originMin[axis],
+            packet.invDirMin[axis], packet.invDirMax[axis], lo, hi);
+        exit = std::min(exit, hi);
+    }
+
+    //the same tolerances as the per-ray test, so nothing it would accept is culled
+    return exit <= 0 || enter > exit + EPSILON || enter >= t_max;
+}
+
+/*
+* frustumMisses for the children of a wide node at once: a bit per child some ray of the packet may enter before t_max.
+* the packet must be coherent. unused slots have NaN bounds and never pass, as in intersectChildren.
+*/
+template<uint32_t Width, uint32_t Size>
+inline uint32_t frustumChildren(const BVHWideNode<Width>& node, const RayPacket<Size>& packet, float t_max) {
+    const float* mins[3] = { node.min_x, node.min_y, node.min_z };
+    const float* maxs[3] = { node.max_x, node.max_y, node.max_z };
+    uint32_t mask = 0;
+
+#ifdef PLAYRT_SSE
+    for (uint32_t offset = 0; offset < Width; offset += 4) {
+        __m128 enter = _mm_set1_ps(-MAX_SCALAR_V), exit = _mm_set1_ps(MAX_SCALAR_V);
+        for (int axis = 0; axis < 3; ++axis) {
+            const bool bPositive = packet.invDirMin[axis] >= 0;
+            const __m128 near_plane = _mm_load_ps((bPositive ? mins[axis] : maxs[axis]) + offset);
+            const __m128 far_plane = _mm_load_ps((bPositive ? maxs[axis] : mins[axis]) + offset);
+            const __m128 o0 = _mm_set1_ps(packet.originMin[axis]), o1 = _mm_set1_ps(packet.originMax[axis]);
+            const __m128 i0 = _mm_set1_ps(packet.invDirMin[axis]), i1 = _mm_set1_ps(packet.invDirMax[axis]);
+
+            __m128 a0 = _mm_sub_ps(near_plane, o1), a1 = _mm_sub_ps(near_plane, o0);
+            __m128 lo = _mm_min_ps(_mm_min_ps(_mm_mul_ps(a0, i0), _mm_mul_ps(a0, i1)), _mm_min_ps(_mm_mul_ps(a1, i0), _mm_mul_ps(a1, i1)));
+            enter = _mm_max_ps(enter, lo);
+
+            a0 = _mm_sub_ps(far_plane, o1);
+            a1 = _mm_sub_ps(far_plane, o0);
+            __m128 hi = _mm_max_ps(_mm_max_ps(_mm_mul_ps(a0, i0), _mm_mul_ps(a0, i1)), _mm_max_ps(_mm_mul_ps(a1, i0), _mm_mul_ps(a1, i1)));
+            exit = _mm_min_ps(exit, hi);
+        }
+
+        const __m128 hit = _mm_and_ps(
+            _mm_and_ps(_mm_cmpgt_ps(exit, _mm_setzero_ps()), _mm_cmple_ps(enter, _mm_add_ps(exit, _mm_set1_ps(EPSILON)))),
+            _mm_cmplt_ps(enter, _mm_set1_ps(t_max)));
+        mask |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << offset;
+    }
+#else
+    for (uint32_t c = 0; c < Width; ++c) {
+        float enter = -MAX_SCALAR_V, exit = MAX_SCALAR_V;
+        for (int axis = 0; axis < 3; ++axis) {
+            const bool bPositive = packet.invDirMin[axis] >= 0;
+            const float near_plane = bPositive ? mins[axis][c] : maxs[axis][c];
+            const float far_plane = bPositive ? maxs[axis][c] : mins[axis][c];
+
+            float lo, hi;
+            intervalProduct(near_plane - packet.originMax[axis], near_plane - packet.originMin[axis],
+                packet.invDirMin[axis], packet.invDirMax[axis], lo, hi);
+            enter = std::max(enter, lo);
+
+            intervalProduct(far_plane - packet.originMax[axis], far_plane - packet.originMin[axis],
+                packet.invDirMin[axis], packet.invDirMax[axis], lo, hi);
+            exit = std::min(exit, hi);
+        }
+        if (exit > 0 && enter <= exit + EPSILON && enter < t_max) mask |= 1u << c;
+    }
+#endif
+
+    return mask;
+}
+
+/*
+* per-ray slab test of the lanes in mask against one box;
+* returns the lanes that hit before their own t_max, and the smallest entry distance among them.
+*/
+template<uint32_t Size>
+inline uint32_t intersectPacketBox(const vec3& bounds_min, const vec3& bounds_max, const RayPacket<Size>& packet,
+    const float* t_max, uint32_t mask, float& min_enter)
+{
+    uint32_t hit_mask = 0;
+    alignas(32) float enter[Size];
+
+#ifdef PLAYRT_SSE
+    const __m128 min_x = _mm_set1_ps(bounds_min.x), min_y = _mm_set1_ps(bounds_min.y), min_z = _mm_set1_ps(bounds_min.z);
+    const __m128 max_x = _mm_set1_ps(bounds_max.x), max_y = _mm_set1_ps(bounds_max.y), max_z = _mm_set1_ps(bounds_max.z);
+    const __m128 epsilon = _mm_set1_ps(EPSILON);
+
+    for (uint32_t group = 0; group < Size; group += 4) {
+        if (((mask >> group) & 0xF) == 0) continue;
+
+        const __m128 ox = _mm_load_ps(packet.origin_x + group), oy = _mm_load_ps(packet.origin_y + group), oz = _mm_load_ps(packet.origin_z + group);
+        const __m128 ix = _mm_load_ps(packet.invDir_x + group), iy = _mm_load_ps(packet.invDir_y + group), iz = _mm_load_ps(packet.invDir_z + group);
+
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(min_x, ox), ix), t1x = _mm_mul_ps(_mm_sub_ps(max_x, ox), ix);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(min_y, oy), iy), t1y = _mm_mul_ps(_mm_sub_ps(max_y, oy), iy);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(min_z, oz), iz), t1z = _mm_mul_ps(_mm_sub_ps(max_z, oz), iz);
+
+        __m128 max_enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+        __m128 min_exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+        __m128 hit = _mm_and_ps(
+            _mm_and_ps(_mm_cmpgt_ps(min_exit, _mm_setzero_ps()), _mm_cmple_ps(max_enter, _mm_add_ps(min_exit, epsilon))),
+            _mm_cmplt_ps(max_enter, _mm_loadu_ps(t_max + group)));
+
+        _mm_store_ps(enter + group, max_enter);
+        hit_mask |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << group;
+    }
+#else
+    for (uint32_t lane = 0; lane < Size; ++lane) {
+        if (!(mask & (1u << lane))) continue;
+
+        vec3 origin(packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane]);
+        vec3 invDir(packet.invDir_x[lane], packet.invDir_y[lane], packet.invDir_z[lane]);
+        vec3 t0 = (bounds_min - origin) * invDir;
+        vec3 t1 = (bounds_max - origin) * invDir;
+        vec3 t_near = glm::min(t0, t1);
+        vec3 t_far = glm::max(t0, t1);
+        float max_enter = max3(t_near.x, t_near.y, t_near.z);
+        float min_exit = min3(t_far.x, t_far.y, t_far.z);
+
+        enter[lane] = max_enter;
+        if (min_exit > 0 && max_enter <= min_exit + EPSILON && max_enter < t_max[lane]) hit_mask |= 1u << lane;
+    }
+#endif
+
+    hit_mask &= mask;
+    min_enter = MAX_SCALAR_V;
+    for (uint32_t lanes = hit_mask; lanes; lanes &= lanes - 1) {
+        min_enter = std::min(min_enter, enter[std::countr_zero(lanes)]);
+    }
+    return hit_mask;
+}
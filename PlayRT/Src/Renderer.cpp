@@ -1,66 +1,409 @@
 #include "Renderer.h"
+#include <chrono>
+#include <unordered_map>
 
  
 void Scene::buildBVH()
 {
-	this->bvh = make_shared<BVH<Triangle>>(triangles);
+	looseMesh = triangles.empty() ? nullptr : make_shared<const TriangleMesh>(triangles);
+	buildTLAS();
+}
+
+void Scene::buildTLAS()
+{
+	tlasInstances = instances;
+	if (looseMesh) tlasInstances.emplace_back(looseMesh);
+	for (auto& instance : tlasInstances) instance.updateBounds();
+
+	this->tlas = make_shared<BVH<Instance>>(tlasInstances);
+	collectLights();
+}
+
+void Scene::refit()
+{
+	if (!tlas) throw runtime_error("BVH is not built");
+
+	for (auto& instance : tlasInstances) instance.updateBounds();
+	tlas->refit(tlasInstances);
+	collectLights();
+}
+
+void Scene::collectLights()
+{
+	lights.clear();
+	lightCdf.clear();
+	lightPower = 0.0f;
+
+	//emitters of every mesh found once, however many instances it has
+	unordered_map<const TriangleMesh*, vector<uint32_t>> meshEmitters;
+	for (const auto& instance : tlasInstances) {
+		const TriangleMesh& mesh = instance.getMesh();
+		if (meshEmitters.count(&mesh)) continue;
+
+		auto& emitters = meshEmitters[&mesh];
+		for (uint32_t j = 0; j < mesh.triangles.size(); ++j) {
+			if (getMaterial(mesh.triangles[j].materialId).isEmissive()) emitters.push_back(j);
+		}
+	}
+
+	for (uint32_t i = 0; i < tlasInstances.size(); ++i) {
+		for (uint32_t j : meshEmitters[&tlasInstances[i].getMesh()]) {
+			//the area the instance gives it
+			const Triangle triangle = tlasInstances[i].worldTriangle(j);
+			const float power = triangle.area() * luminance(getMaterial(triangle.materialId).emission);
+			if (power <= 0.0f) continue;
+
+			lightPower += power;
+			lights.push_back({ i, j });
+			lightCdf.push_back(lightPower);
+		}
+	}
+
+	for (auto& c : lightCdf) c /= lightPower;
 }
 
 optional<Intersection> Scene::intersect(const Ray& ray) const
 {
-	if (!bvh) throw runtime_error("BVH is not built"); 
+	if (!tlas) throw runtime_error("BVH is not built"); 
+
+	return tlas->intersect(ray);
+}
+
+bool Scene::occluded(const Ray& ray) const
+{
+	if (!tlas) throw runtime_error("BVH is not built");
+
+	return tlas->occluded(ray);
+}
+
+const Material& Scene::getMaterial(uint32_t materialId) const
+{
+	static const Material defaultMaterial;
+	return materialId < materials.size() ? materials[materialId] : defaultMaterial;
+}
+
+const Material& Scene::getMaterial(const Intersection& hit) const
+{
+	return getMaterial(tlasInstances[hit.primIndex].getMesh().triangles[hit.meshPrimIndex].materialId);
+}
+
+optional<LightSample> Scene::sampleLight(const vec3& position, float uLight, const vec2& uPoint) const
+{
+	if (lights.empty()) return nullopt;
+
+	const size_t pick = std::min<size_t>(std::upper_bound(lightCdf.begin(), lightCdf.end(), uLight) - lightCdf.begin(), lights.size() - 1);
+	const Triangle triangle = tlasInstances[lights[pick].instance].worldTriangle(lights[pick].meshPrimIndex);
+	const vec3 emission = getMaterial(triangle.materialId).emission;
+
+	const vec3 toLight = triangle.pointAt(sampleUniformTriangle(uPoint)) - position;
+	const float distance2 = glm::dot(toLight, toLight);
+	if (distance2 <= 0.0f) return nullopt;
+
+	LightSample sample;
+	sample.distance = std::sqrt(distance2);
+	sample.direction = toLight / sample.distance;
+	sample.emission = emission;
+
+	//picked with power / lightPower, area pdf 1 / area; the areas cancel
+	const vec3 lightNormal = normalize(cross(triangle.v1.position - triangle.v0.position, triangle.v2.position - triangle.v0.position));
+	const float cosLight = std::abs(glm::dot(lightNormal, sample.direction));
+	if (cosLight <= 0.0f) return nullopt;
+	sample.pdf = luminance(emission) * distance2 / (lightPower * cosLight);
+	return sample;
+}
+
+float Scene::lightPdf(const Ray& ray, const Intersection& hit) const
+{
+	if (lights.empty()) return 0.0f;
+
+	const float emitted = luminance(getMaterial(hit).emission);
+	const float cosLight = std::abs(glm::dot(normalize(hit.normal), ray.direction));
+	if (emitted <= 0.0f || cosLight <= 0.0f) return 0.0f;
+	return emitted * hit.travel_t * hit.travel_t / (lightPower * cosLight);
+}
+
+
+
+Renderer::Renderer(uint32_t width, uint32_t height)
+{
+	resize(width, height);
+}
+
+void Renderer::resize(uint32_t width, uint32_t height)
+{
+	this->width = width;
+	this->height = height;
+
+	tiles.clear();
+	for (uint32_t y0 = 0; y0 < height; y0 += TILE_SIZE) {
+		for (uint32_t x0 = 0; x0 < width; x0 += TILE_SIZE) {
+			tiles.push_back({ x0, y0, std::min(x0 + TILE_SIZE, width), std::min(y0 + TILE_SIZE, height) });
+		}
+	}
+
+	resetAccumulation();
+}
 
-	return bvh->intersect(ray);
+void Renderer::resetAccumulation()
+{
+	accumulation.assign(width * height, vec3(0.0f));
+	framebuffer.assign(width * height, vec3(0.0f));
+	for (auto& tile : tiles) tile.sampleCount = 0;
 }
 
 
+//x, y in pixels; integer coordinates are the pixel corners
+Ray Renderer::primaryRay(float x, float y, const Camera& camera) const
+{
+	float HeightScale = tan(deg2rad(camera.fov) / 2.0f);
+	float WidthScale = HeightScale * (float)width / height;
+
+	vec2 screenCoord = vec2(x, y) / vec2(width, height) * 2.0f - 1.0f; 
+	screenCoord.x = WidthScale * screenCoord.x;
+	screenCoord.y = HeightScale * screenCoord.y;
+
+	vec3 rayDir =  normalize(vec3(screenCoord.x, screenCoord.y, 1.0f));
+
+	return Ray{ cameraOrigin , rayDir};
+}
+
 
 void Renderer::render(const Scene& scene)
 {
-	framebuffer.resize(WIDTH * HEIGHT);
+	//tasks must not throw on the workers
+	if (!scene.tlas) throw runtime_error("BVH is not built");
 
-	float HeightScale = tan(deg2rad(scene.camera.fov) / 2.0f);
-	float WidthScale = HeightScale * (float)WIDTH / HEIGHT;
+	const auto start = chrono::steady_clock::now();
+	atomic<uint64_t> rays{ 0 };
 
-	for (uint32_t j = 0; j < HEIGHT; ++j) {
-		for (uint32_t i = 0; i < WIDTH; ++i) {
+	if (!bParallel) {
+		for (auto& tile : tiles) rays += renderTile(scene, tile);
+	}
+	else {
+		ThreadPool& threads = pool ? *pool : ThreadPool::shared();
+		atomic<int> remaining{ static_cast<int>(tiles.size()) };
+		for (auto& tile : tiles) {
+			threads.submit([&, tilePtr = &tile] {
+				rays.fetch_add(renderTile(scene, *tilePtr), memory_order_relaxed);
+				if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) threads.notifyDone();
+				});
+		}
+		threads.wait(remaining);
+	}
+
+	frameStats.samples = static_cast<uint64_t>(width) * height;
+	frameStats.rays = rays.load();
+	frameStats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	totalStats.samples += frameStats.samples;
+	totalStats.rays += frameStats.rays;
+	totalStats.seconds += frameStats.seconds;
+}
 
-			vec2 screenCoord = vec2(i, j) / vec2(WIDTH, HEIGHT) * 2.0f - 1.0f; 
-			screenCoord.x = WidthScale * screenCoord.x;
-			screenCoord.y = HeightScale * screenCoord.y;
- 
-			vec3 rayDir =  normalize(vec3(screenCoord.x, screenCoord.y, 1.0f));
 
-			Ray ray{ cameraOrigin , rayDir};
+/*
+* tiles cover disjoint pixels, so a tile writes its part of the buffers without locking.
+* a path is seeded from its pixel and sample index, and draws its jitter over the pixel first.
+* returns the rays traced.
+*/
+uint64_t Renderer::renderTile(const Scene& scene, Tile& tile)
+{
+	vector<PathState> paths;
+	vector<Ray> primaryRays;
+	paths.reserve(tile.pixelCount());
+	primaryRays.reserve(tile.pixelCount());
+
+	for (uint32_t j = tile.y0; j < tile.y1; ++j) {
+		for (uint32_t i = tile.x0; i < tile.x1; ++i) {
+			auto& path = paths.emplace_back(RNG::splitMix64(seed) ^ ((static_cast<uint64_t>(tile.sampleCount) << 32) | (j * width + i)));
+			const vec2 jitter = path.rng.next2D();
+			primaryRays.push_back(primaryRay(i + jitter.x, j + jitter.y, scene.camera));
+		}
+	}
 
-			framebuffer[j * WIDTH + i] = traceRay(ray, scene, 0);
+	vector<vec3> radiance(tile.pixelCount(), vec3(0.0f));
+	if (bPacketTracing) {
+		tracePackets(scene, primaryRays, tile, paths, radiance);
+	}
+	else {
+		for (uint32_t slot = 0; slot < tile.pixelCount(); ++slot) {
+			radiance[slot] = traceRay(primaryRays[slot], scene, paths[slot]);
 		}
-	} 
+	}
+
+	++tile.sampleCount;
+	const float weight = 1.0f / tile.sampleCount;
+	for (uint32_t j = tile.y0; j < tile.y1; ++j) {
+		for (uint32_t i = tile.x0; i < tile.x1; ++i) {
+			const uint32_t pixel = j * width + i;
+			accumulation[pixel] += radiance[(j - tile.y0) * tile.width() + (i - tile.x0)];
+			framebuffer[pixel] = accumulation[pixel] * weight;
+		}
+	}
+
+	uint64_t rays = 0;
+	for (auto& path : paths) rays += path.rayCount;
+	return rays;
 }
 
 
-vec3 Renderer::traceRay(const Ray& ray, const Scene& scene, uint32_t depth) const
+/*
+* same result as traceRay: the camera rays of every 4x4 pixel block go through the scene as one packet,
+* so do the shadow rays of their hits, which leave from nearby points for the same lights.
+* each path is then carried on from its first bounce ray by ray. slots index the tile's pixels.
+*/
+void Renderer::tracePackets(const Scene& scene, const vector<Ray>& primaryRays, const Tile& tile,
+	vector<PathState>& paths, vector<vec3>& radiance) const
 {
-	if (depth > maxDepth) return vec3(0.0); 
-	
-	vec3 color(background);
-	if (auto isetOpt = scene.intersect(ray); isetOpt.has_value()) {
-          
-		auto iset = isetOpt.value();
-        vec3 normal = normalize(iset.normal);
-		vec3 newDir = reflect(ray.direction, normal);
-		Ray newRay{ iset.position + normal * 0.001f, newDir };
+	for (uint32_t j0 = 0; j0 < tile.height(); j0 += PRIMARY_PACKET_DIM) {
+		for (uint32_t i0 = 0; i0 < tile.width(); i0 += PRIMARY_PACKET_DIM) {
+			RayPacket<PRIMARY_PACKET_SIZE> packet;
+			uint32_t slots[PRIMARY_PACKET_SIZE];
+
+			for (uint32_t j = j0; j < std::min(j0 + PRIMARY_PACKET_DIM, tile.height()); ++j) {
+				for (uint32_t i = i0; i < std::min(i0 + PRIMARY_PACKET_DIM, tile.width()); ++i) {
+					slots[packet.count] = j * tile.width() + i;
+					packet.add(primaryRays[j * tile.width() + i]);
+				}
+			}
+			packet.finalize();
 
-		//todo: shading
-		color = vec3(1.0f);
-		 
-        color += traceRay(newRay, scene, depth + 1);
+			auto hits = scene.intersect(packet);
 
-		//cout << "actual hit!" << '\n';
-        return color;  
-	} 
+			PathVertex vertices[PRIMARY_PACKET_SIZE];
+			RayPacket<PRIMARY_PACKET_SIZE> shadowPacket;
+			uint32_t shadowLanes[PRIMARY_PACKET_SIZE];
+			for (uint32_t lane = 0; lane < packet.count; ++lane) {
+				const uint32_t slot = slots[lane];
+				++paths[slot].rayCount;
+				vertices[lane] = shadeVertex(scene, *packet.rays[lane], hits[lane], paths[slot], radiance[slot]);
+				if (vertices[lane].shadowRay.has_value()) {
+					shadowLanes[shadowPacket.count] = lane;
+					shadowPacket.add(*vertices[lane].shadowRay);
+				}
+			}
+			shadowPacket.finalize();
 
-	return color;
+			//mixed direction signs cannot be culled as a whole, the single-ray path is faster then
+			uint32_t blocked = 0;
+			if (shadowPacket.bCoherent) {
+				blocked = scene.occluded(shadowPacket);
+			}
+			else {
+				for (uint32_t k = 0; k < shadowPacket.count; ++k) {
+					if (scene.occluded(*shadowPacket.rays[k])) blocked |= 1u << k;
+				}
+			}
+
+			for (uint32_t k = 0; k < shadowPacket.count; ++k) {
+				const uint32_t lane = shadowLanes[k];
+				++paths[slots[lane]].rayCount;
+				if (!(blocked & (1u << k))) radiance[slots[lane]] += vertices[lane].shadowContribution;
+			}
+
+			for (uint32_t lane = 0; lane < packet.count; ++lane) {
+				tracePath(scene, vertices[lane].bounce, paths[slots[lane]], radiance[slots[lane]]);
+			}
+		}
+	}
 }
 
 
+//off the surface to the side dir leaves on, scaled with the magnitude of the position
+static vec3 offsetRayOrigin(const vec3& position, const vec3& normal, const vec3& dir)
+{
+	const float offset = 1e-4f * std::max(1.0f, max3(std::abs(position.x), std::abs(position.y), std::abs(position.z)));
+	return position + normal * (glm::dot(dir, normal) > 0.0f ? offset : -offset);
+}
+
+
+/*
+* adds the emission ray found, weighed by MIS unless the path got here by a camera ray or a delta bounce;
+* then samples a light and the BSDF for the next vertex.
+*/
+PathVertex Renderer::shadeVertex(const Scene& scene, const Ray& ray, const optional<Intersection>& hit,
+	PathState& path, vec3& radiance) const
+{
+	PathVertex vertex;
+	if (!hit.has_value()) {
+		radiance += path.throughput * background;
+		return vertex;
+	}
+
+	const Intersection& iset = hit.value();
+	const Material& material = scene.getMaterial(iset);
+	const vec3 normal = normalize(iset.normal);
+	const vec3 wo = -ray.direction;
+
+	if (material.isEmissive()) {
+		const float weight = path.bSpecular ? 1.0f : powerHeuristic(path.bsdfPdf, scene.lightPdf(ray, iset));
+		radiance += path.throughput * material.emission * weight;
+	}
+
+	//next event estimation; the last vertex traces no BSDF ray that could share the light with it, so it takes it all
+	const bool bLastVertex = path.depth + 1 > maxDepth;
+	if (!material.isDelta() && scene.hasLights()) {
+		const float uLight = path.rng.next1D();
+		const vec2 uPoint = path.rng.next2D();
+		if (auto light = scene.sampleLight(iset.position, uLight, uPoint); light.has_value()) {
+			float bsdfPdf;
+			const vec3 f = evalBSDF(material, normal, wo, light->direction, bsdfPdf);
+			if (bsdfPdf > 0.0f) {
+				Ray shadowRay{ offsetRayOrigin(iset.position, normal, light->direction), light->direction };
+				shadowRay.t_max = light->distance * (1.0f - 1e-3f);
+				vertex.shadowRay = shadowRay;
+				const float weight = bLastVertex ? 1.0f : powerHeuristic(light->pdf, bsdfPdf);
+				vertex.shadowContribution = path.throughput * f * light->emission * (weight / light->pdf);
+			}
+		}
+	}
+
+	if (bLastVertex) return vertex;
+
+	if (path.depth >= rouletteDepth) {
+		const float survival = std::min(static_cast<float>(russianRoulette), max3(path.throughput.x, path.throughput.y, path.throughput.z));
+		if (path.rng.next1D() >= survival) return vertex;
+		path.throughput /= survival;
+	}
+
+	const vec2 u = path.rng.next2D();
+	const float uc = path.rng.next1D();
+	auto sample = sampleBSDF(material, normal, wo, u, uc);
+	if (!sample.has_value()) return vertex;
+
+	path.throughput *= sample->weight;
+	path.bsdfPdf = sample->pdf;
+	path.bSpecular = sample->bDelta;
+	++path.depth;
+	if (max3(path.throughput.x, path.throughput.y, path.throughput.z) <= 0.0f) return vertex;
+
+	vertex.bounce = Ray{ offsetRayOrigin(iset.position, normal, sample->wi), sample->wi };
+	return vertex;
+}
+
+
+vec3 Renderer::traceRay(const Ray& ray, const Scene& scene, PathState& path) const
+{
+	vec3 radiance(0.0f);
+	tracePath(scene, ray, path, radiance);
+	return radiance;
+}
+
+
+//the rest of a path from its next ray on, adding to what it gathered so far
+void Renderer::tracePath(const Scene& scene, optional<Ray> next, PathState& path, vec3& radiance) const
+{
+	while (next.has_value()) {
+		++path.rayCount;
+		PathVertex vertex = shadeVertex(scene, *next, scene.intersect(*next), path, radiance);
+
+		if (vertex.shadowRay.has_value()) {
+			++path.rayCount;
+			if (!scene.occluded(*vertex.shadowRay)) radiance += vertex.shadowContribution;
+		}
+		next = vertex.bounce;
+	}
+}
+
+
+
@@ -1,17 +1,30 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <array>
+#include <atomic>
 
 using namespace std;
 
 #include "Math.h"
 #include "BVH.h"
 #include "Triangle.h"
+#include "Instance.h"
 #include "Ray.h"
+#include "Material.h"
+#include "Sampling.h"
+#include "ThreadPool.h"
 
 
-constexpr uint32_t WIDTH = 160;
-constexpr uint32_t HEIGHT = 90;
+constexpr uint32_t DEFAULT_WIDTH = 160;
+constexpr uint32_t DEFAULT_HEIGHT = 90;
+
+//the image is rendered in square tiles, one pool task each; a multiple of the packet size
+constexpr uint32_t TILE_SIZE = 32;
+
+//camera rays and their shadow rays are traced as 4x4 pixel packets, the rest of each path ray by ray
+constexpr uint32_t PRIMARY_PACKET_DIM = 4;
+constexpr uint32_t PRIMARY_PACKET_SIZE = PRIMARY_PACKET_DIM * PRIMARY_PACKET_DIM;
 
   
 
@@ -22,26 +35,164 @@ struct Camera {
 
 
 
+//a point on an emitter, as seen from the shading point it was sampled for
+struct LightSample {
+	vec3 direction;    //unit, towards the light
+	float distance;
+	vec3 emission;
+	float pdf;         //solid angle, light selection included
+};
+
+
+/*
+* two levels: every TriangleMesh has its BLAS, built with the mesh, and the TLAS is a BVH over instances of them.
+* the loose triangles are one more mesh, in world space, under an identity instance.
+*/
 class Scene {
 public:
+	//builds the mesh of the loose triangles, then the TLAS
 	void buildBVH();
+	//after instances were added or moved; the meshes keep their BLAS.
+	//also collects the emitters, whose indices change as the TLAS reorders the instances
+	void buildTLAS();
+	//after meshes were refit (TriangleMesh::refit) and nothing else changed: the TLAS is refit too, not built anew.
+	//the loose triangles are static
+	void refit();
 	optional<Intersection> intersect(const Ray& ray) const;
+	bool occluded(const Ray& ray) const;
+	const Material& getMaterial(uint32_t materialId) const;
+	//of the triangle hit
+	const Material& getMaterial(const Intersection& hit) const;
+
+	//an emitter picked in proportion to its power, a point uniform over its area
+	optional<LightSample> sampleLight(const vec3& position, float uLight, const vec2& uPoint) const;
+	//the pdf sampleLight has for the point where ray hit an emitter
+	float lightPdf(const Ray& ray, const Intersection& hit) const;
+	bool hasLights() const { return !lights.empty(); }
+
+	template<uint32_t Size>
+	array<optional<Intersection>, Size> intersect(const RayPacket<Size>& packet) const {
+		if (!tlas) throw runtime_error("BVH is not built");
+		return tlas->intersect(packet);
+	}
+
+	template<uint32_t Size>
+	uint32_t occluded(const RayPacket<Size>& packet) const {
+		if (!tlas) throw runtime_error("BVH is not built");
+		return tlas->occluded(packet);
+	}
 	
 	Camera camera; 
-	vector<Triangle> triangles;  
-	shared_ptr<BVH<Triangle>> bvh;
+	vector<Triangle> triangles;   //loose, in world space
+	vector<Instance> instances;
+	vector<Material> materials;   //by Triangle::materialId, ids past the end get the default Lambertian
+	shared_ptr<BVH<Instance>> tlas;
+
+private:
+	void collectLights();
+
+	//what the TLAS is built over: instances, then the one of the loose triangles
+	vector<Instance> tlasInstances;
+	shared_ptr<const TriangleMesh> looseMesh;
+
+	struct Light {
+		uint32_t instance;   //in tlasInstances
+		uint32_t meshPrimIndex;
+	};
+	vector<Light> lights;
+	vector<float> lightCdf;
+	float lightPower = 0.0f;
+};
+
+
+//one camera path, carried from vertex to vertex
+struct PathState {
+	explicit PathState(uint64_t seed) : rng(seed) {}
+
+	vec3 throughput{ 1.0f };
+	float bsdfPdf = 0.0f;      //of the last bounce, weighs the emitter it hits against light sampling
+	bool bSpecular = true;     //camera ray or delta bounce: the emitter it hits counts in full
+	uint32_t depth = 0;
+	uint32_t rayCount = 0;     //shadow rays included
+	RNG rng;
+};
+
+//what a vertex hands on: a light sample that counts if its shadow ray is not blocked, and the next ray
+struct PathVertex {
+	optional<Ray> shadowRay;
+	vec3 shadowContribution{ 0.0f };
+	optional<Ray> bounce;
+};
+
+struct RenderStats {
+	uint64_t samples = 0;      //camera paths
+	uint64_t rays = 0;
+	double seconds = 0.0;
+
+	double samplesPerSecond() const { return seconds > 0.0 ? samples / seconds : 0.0; }
+	double raysPerSecond() const { return seconds > 0.0 ? rays / seconds : 0.0; }
+};
+
+
+//pixels [x0, x1) x [y0, y1), with its own count of accumulated samples
+struct Tile {
+	uint32_t x0, y0, x1, y1;
+	uint32_t sampleCount = 0;
+
+	uint32_t width() const { return x1 - x0; }
+	uint32_t height() const { return y1 - y0; }
+	uint32_t pixelCount() const { return width() * height(); }
 };
 
 
+/*
+* progressive path tracer: every render() adds one path per pixel, tile by tile across the pool,
+* and framebuffer holds the running average. resetAccumulation() after the scene or camera changed.
+* lights are sampled at every non-delta vertex and weighed against BSDF sampling by the power heuristic.
+*/
 class Renderer {
 public:
+	explicit Renderer(uint32_t width = DEFAULT_WIDTH, uint32_t height = DEFAULT_HEIGHT);
+
+	void resize(uint32_t width, uint32_t height);
+	void resetAccumulation();
+
 	void render(const Scene& scene);  
-	vec3 traceRay(const Ray& ray, const Scene& scene, uint32_t depth) const;
+	vec3 traceRay(const Ray& ray, const Scene& scene, PathState& path) const;
+	Ray primaryRay(float x, float y, const Camera& camera) const;
+
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+	uint32_t getSampleCount() const { return tiles.empty() ? 0 : tiles[0].sampleCount; }
 
 
 	vec3 cameraOrigin{ 0.0f, 0.0f, -1.0 }; 
 	vec3 background{ 0.1f };
 	vector<vec3> framebuffer; 
-	uint32_t maxDepth = 1;
-	double russianRoulette = 0.8;
+	uint32_t maxDepth = 5;            //bounces after the camera ray
+	uint32_t rouletteDepth = 3;       //bounces before russian roulette starts
+	double russianRoulette = 0.95;    //most a path may survive a round of roulette with
+
+	RenderStats frameStats;           //last render()
+	RenderStats totalStats;           //since resetAccumulation()
+
+	uint64_t seed = 0;                //varies the random sequence of every path
+
+	//the same image with the first hits traced as packets; pays off on surfaces a packet's rays mostly hit together,
+	//not on geometry finer than a 4x4 pixel block. bounces scatter too much to share a frustum
+	bool bPacketTracing = false;
+	bool bParallel = true;
+	ThreadPool* pool = nullptr;   //null: ThreadPool::shared()
+
+private:
+	uint64_t renderTile(const Scene& scene, Tile& tile);
+	void tracePackets(const Scene& scene, const vector<Ray>& primaryRays, const Tile& tile,
+		vector<PathState>& paths, vector<vec3>& radiance) const;
+	void tracePath(const Scene& scene, optional<Ray> next, PathState& path, vec3& radiance) const;
+	PathVertex shadeVertex(const Scene& scene, const Ray& ray, const optional<Intersection>& hit,
+		PathState& path, vec3& radiance) const;
+
+	uint32_t width = 0, height = 0;
+	vector<Tile> tiles;
+	vector<vec3> accumulation;
 };
\ No newline at end of file
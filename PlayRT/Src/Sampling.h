@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+
+#include "Math.h"
+
+
+/*
+* random numbers and sample warps of the path tracer.
+* every path owns its own generator, seeded from its pixel and sample index,
+* so an image does not depend on which thread traced which path, or in which order.
+*/
+struct RNG {
+    explicit RNG(uint64_t seed = 0) : state(0) {
+        nextUInt();
+        state += splitMix64(seed);
+        nextUInt();
+    }
+
+    //PCG32 (XSH RR)
+    uint32_t nextUInt() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+    //[0, 1)
+    float next1D() { return static_cast<float>(nextUInt() >> 8) * (1.0f / 16777216.0f); }
+    vec2 next2D() {
+        float x = next1D();
+        return vec2(x, next1D());
+    }
+
+    static uint64_t splitMix64(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    uint64_t state;
+};
+
+
+//orthonormal basis with n as z (Duff et al. 2017)
+struct Frame {
+    explicit Frame(const vec3& normal) : n(normal) {
+        const float sign = std::copysign(1.0f, n.z);
+        const float a = -1.0f / (sign + n.z);
+        const float b = n.x * n.y * a;
+        t = vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        s = vec3(b, sign + n.y * n.y * a, -n.y);
+    }
+
+    vec3 toLocal(const vec3& v) const { return vec3(glm::dot(v, t), glm::dot(v, s), glm::dot(v, n)); }
+    vec3 toWorld(const vec3& v) const { return t * v.x + s * v.y + n * v.z; }
+
+    vec3 t, s, n;
+};
+
+
+//local z up, pdf cos / pi
+inline vec3 sampleCosineHemisphere(const vec2& u) {
+    const float r = std::sqrt(u.x);
+    const float phi = 2.0f * PI * u.y;
+    return vec3(r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.0f, 1.0f - u.x)));
+}
+
+//barycentrics (b1, b2) of a point uniform over a triangle
+inline vec2 sampleUniformTriangle(const vec2& u) {
+    const float su = std::sqrt(u.x);
+    return vec2(1.0f - su, u.y * su);
+}
+
+//weight of a sample taken with pdf_a that strategy b could also have taken, beta = 2
+inline float powerHeuristic(float pdf_a, float pdf_b) {
+    const float a = pdf_a * pdf_a, b = pdf_b * pdf_b;
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+inline float luminance(const vec3& c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+
+using namespace std;
+
+
+/*
+* workers shared by the BVH builder and the renderer.
+* every worker owns a deque: it runs its newest task first, an idle thread steals the oldest task of another worker.
+* tasks submitted by a worker go to its own deque, the ones from other threads are dealt round robin.
+* a thread waiting on a counter runs tasks instead of blocking,
+* so tasks may themselves submit work and wait for it.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t numThreads = defaultThreadCount())
+    {
+        numThreads = std::max(1u, numThreads);
+        for (uint32_t i = 0; i < numThreads; ++i)
+            queues.push_back(make_unique<WorkQueue>());
+        for (uint32_t i = 0; i < numThreads; ++i)
+            workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            bExit = true;
+        }
+        sleepCV.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //the caller takes part in waits, so leave it a core
+    static uint32_t defaultThreadCount()
+    {
+        uint32_t hw = thread::hardware_concurrency();
+        return hw > 1 ? hw - 1 : 1;
+    }
+
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    uint32_t threadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+    void submit(function<void()> task)
+    {
+        const size_t target = currentPool == this ? currentWorker
+            : nextQueue.fetch_add(1, memory_order_relaxed) % queues.size();
+        {
+            lock_guard<mutex> lock(queues[target]->queueMutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        queuedTasks.fetch_add(1, memory_order_release);
+
+        { lock_guard<mutex> lock(sleepMutex); }
+        sleepCV.notify_one();
+    }
+
+    //returns once remaining is 0; until then the caller steals and runs tasks like a worker would
+    void wait(const atomic<int>& remaining)
+    {
+        while (remaining.load(memory_order_acquire) > 0) {
+            function<void()> task;
+            if (takeTask(task)) {
+                task();
+                continue;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            sleepCV.wait(lock, [&] {
+                return queuedTasks.load(memory_order_acquire) > 0 || remaining.load(memory_order_acquire) <= 0;
+                });
+        }
+    }
+
+    //a waiter may sleep on sleepCV with nothing queued, so the task that zeroes its counter has to wake it
+    void notifyDone()
+    {
+        { lock_guard<mutex> lock(sleepMutex); }
+        sleepCV.notify_all();
+    }
+
+    /*
+    * fork-join over [0, count): a range of 2 * grainSize or more is halved, the upper half pushed to this
+    * thread's deque, the lower half kept. thieves take the oldest, i.e. largest, halves first,
+    * so the work spreads in log steps and every fn(begin, end) call gets between grainSize and 2 * grainSize.
+    */
+    template<typename Func>
+    void parallelFor(size_t count, size_t grainSize, Func&& fn)
+    {
+        if (count == 0) return;
+        grainSize = std::max<size_t>(1, grainSize);
+
+        //ranges not yet finished, each split adds one before handing the half off
+        atomic<int> openRanges{ 1 };
+        splitRange(0, count, grainSize, fn, openRanges);
+        wait(openRanges);
+    }
+
+private:
+    struct alignas(64) WorkQueue {
+        mutex queueMutex;
+        deque<function<void()>> tasks;
+    };
+
+    //own deque from the back, then the others from the front
+    bool takeTask(function<void()>& task)
+    {
+        const bool bWorker = currentPool == this;
+        const size_t numQueues = queues.size();
+
+        if (bWorker) {
+            auto& own = *queues[currentWorker];
+            lock_guard<mutex> lock(own.queueMutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queuedTasks.fetch_sub(1, memory_order_relaxed);
+                return true;
+            }
+        }
+
+        const size_t first = bWorker ? currentWorker + 1 : 0;
+        for (size_t k = 0; k < numQueues; ++k) {
+            auto& victim = *queues[(first + k) % numQueues];
+            lock_guard<mutex> lock(victim.queueMutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queuedTasks.fetch_sub(1, memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template<typename Func>
+    void splitRange(size_t begin, size_t end, size_t grainSize, Func& fn, atomic<int>& openRanges)
+    {
+        while (end - begin >= 2 * grainSize) {
+            const size_t mid = begin + (end - begin) / 2;
+            openRanges.fetch_add(1, memory_order_relaxed);
+            submit([this, mid, end, grainSize, &fn, &openRanges] { splitRange(mid, end, grainSize, fn, openRanges); });
+            end = mid;
+        }
+        fn(begin, end);
+        if (openRanges.fetch_sub(1, memory_order_acq_rel) == 1) notifyDone();
+    }
+
+    void workerLoop(uint32_t index)
+    {
+        currentPool = this;
+        currentWorker = index;
+
+        while (true) {
+            function<void()> task;
+            if (takeTask(task)) {
+                task();
+                continue;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            sleepCV.wait(lock, [&] { return bExit || queuedTasks.load(memory_order_acquire) > 0; });
+            if (bExit && queuedTasks.load(memory_order_acquire) == 0) return;
+        }
+    }
+
+private:
+    //which pool and deque the running thread works for
+    static inline thread_local ThreadPool* currentPool = nullptr;
+    static inline thread_local size_t currentWorker = 0;
+
+    vector<thread> workers;
+    vector<unique_ptr<WorkQueue>> queues;
+    atomic<size_t> nextQueue{ 0 };
+
+    //counted after the push and under the deque's lock on the pop, so it never runs ahead of the deques
+    atomic<int> queuedTasks{ 0 };
+    mutex sleepMutex;
+    condition_variable sleepCV;
+    bool bExit = false;
+};
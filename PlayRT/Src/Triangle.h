@@ -2,7 +2,9 @@
 
 #include "Math.h"
 #include "BVH.h"
+#include "TriangleBlock.h"
 #include <optional>
+#include <bit>
 
 using namespace std;
 
@@ -15,9 +17,19 @@ struct alignas(16) Vertex {
 class Triangle : IRTPrimitive {
 public:
 	Vertex v0, v1, v2;
+	uint32_t materialId = 0;
 
 	Triangle() = delete;
-	Triangle(const Vertex& v0, const Vertex& v1, const Vertex& v2) : v0(v0), v1(v1), v2(v2) {}
+	Triangle(const Vertex& v0, const Vertex& v1, const Vertex& v2, uint32_t materialId = 0) : v0(v0), v1(v1), v2(v2), materialId(materialId) {}
+
+	float area() const {
+		return 0.5f * glm::length(cross(v1.position - v0.position, v2.position - v0.position));
+	}
+
+	//barycentrics b1, b2 of v1, v2
+	vec3 pointAt(const vec2& b) const {
+		return v0.position * (1.0f - b.x - b.y) + v1.position * b.x + v2.position * b.y;
+	}
 
 	virtual Bounds3 getBoundingBox() const override {
 		Bounds3 bounds;
@@ -61,26 +73,121 @@ public:
 
 
 
+/*
+* a triangle BVH keeps the triangles of every leaf in SoA blocks for the watertight test:
+* 4 wide while leaves hold at most 4 triangles, 8 wide otherwise.
+* the blocks of a leaf start at blockStart[its first triangle].
+*/
+template<>
+class LeafAccel<Triangle> {
+public:
+	static constexpr bool bEnabled = true;
+	using RayData = WatertightRay;
+
+	void build(const vector<Triangle>& triangles, const vector<BVHNode>& nodes, const BVHBuildConfig& config) {
+		blocks4.clear();
+		blocks8.clear();
+		blockStart.assign(triangles.size(), 0);
+
+		if (config.maxLeafSize <= 4) buildBlocks(triangles, nodes, blocks4);
+		else buildBlocks(triangles, nodes, blocks8);
+	}
+
+	optional<Intersection> intersect(const vector<Triangle>& triangles, uint32_t first_prim, uint32_t prim_count,
+		const Ray& ray, const WatertightRay& leafRay, float closest_t) const
+	{
+		if (!blocks8.empty()) return intersectBlocks(blocks8, triangles, first_prim, prim_count, ray, leafRay, closest_t);
+		return intersectBlocks(blocks4, triangles, first_prim, prim_count, ray, leafRay, closest_t);
+	}
+
+private:
+	template<uint32_t Width>
+	void buildBlocks(const vector<Triangle>& triangles, const vector<BVHNode>& nodes, vector<TriangleBlock<Width>>& blocks) {
+		for (const auto& node : nodes) {
+			if (!node.is_leaf()) continue;
+
+			blockStart[node.left_first] = static_cast<uint32_t>(blocks.size());
+			for (uint32_t i = 0; i < node.prim_count; i += Width) {
+				auto& block = blocks.emplace_back();
+				for (uint32_t slot = 0; slot < Width && i + slot < node.prim_count; ++slot) {
+					const uint32_t index = node.left_first + i + slot;
+					const Triangle& triangle = triangles[index];
+					block.set(slot, triangle.v0.position, triangle.v1.position, triangle.v2.position, index);
+				}
+			}
+		}
+	}
+
+	//the normal and position only for the closest hit
+	template<uint32_t Width>
+	optional<Intersection> intersectBlocks(const vector<TriangleBlock<Width>>& blocks, const vector<Triangle>& triangles,
+		uint32_t first_prim, uint32_t prim_count, const Ray& ray, const WatertightRay& leafRay, float closest_t) const
+	{
+		bool bHit = false;
+		uint32_t hit_prim = 0;
+
+		const uint32_t first_block = blockStart[first_prim];
+		const uint32_t end_block = first_block + (prim_count + Width - 1) / Width;
+		for (uint32_t b = first_block; b < end_block; ++b) {
+			alignas(32) float t_hit[Width];
+			for (uint32_t mask = intersectTriangles(blocks[b], leafRay, closest_t, t_hit); mask; mask &= mask - 1) {
+				const uint32_t slot = static_cast<uint32_t>(std::countr_zero(mask));
+				if (t_hit[slot] < closest_t) {
+					closest_t = t_hit[slot];
+					hit_prim = blocks[b].primIndex[slot];
+					bHit = true;
+				}
+			}
+		}
+		if (!bHit) return nullopt;
+
+		const Triangle& triangle = triangles[hit_prim];
+		Intersection isect{};
+		isect.position = ray.origin + ray.direction * closest_t;
+		isect.normal = normalize(cross(triangle.v1.position - triangle.v0.position, triangle.v2.position - triangle.v0.position));
+		isect.travel_t = closest_t;
+		isect.primIndex = hit_prim;
+		return isect;
+	}
+
+	vector<TriangleBlock<4>> blocks4;
+	vector<TriangleBlock<8>> blocks8;
+	vector<uint32_t> blockStart;
+};
+
+
+
+/*
+* triangles in object space with their own BVH, the BLAS every Instance of the mesh shares.
+* the BVH reorders the triangles and keeps a reference to them, so a mesh is built in place and never copied.
+*/
 class TriangleMesh : IRTPrimitive {
 public:
 	vector<Triangle> triangles;
+	BVH<Triangle> blas;
 
 	TriangleMesh() = delete;
-	TriangleMesh(const vector<Triangle>& triangles) : triangles(triangles) {}
+	TriangleMesh(const vector<Triangle>& triangles, const BVHBuildConfig& config = {}) : triangles(triangles), blas(this->triangles, config) {}
+
+	TriangleMesh(const TriangleMesh&) = delete;
+	TriangleMesh& operator=(const TriangleMesh&) = delete;
 
 	virtual Bounds3 getBoundingBox() const override {
-		Bounds3 bounds;
-		for (const auto& triangle : triangles) {
-			auto triBounds = triangle.getBoundingBox();
-			bounds.min = glm::min(bounds.min, triBounds.min);
-			bounds.max = glm::max(bounds.max, triBounds.max);
-		}
-		return bounds;
+		return blas.nodes.empty() ? Bounds3{} : blas.nodes[0].bounds();
 	}
 
 	virtual optional<Intersection> intersect(const Ray& ray) const override
-	{ 
+	{
+		return blas.intersect(ray);
 	}
 
+	bool occluded(const Ray& ray) const
+	{
+		return blas.occluded(ray);
+	}
 
-};
\ No newline at end of file
+	//after the triangles were moved in place; true if part of the BLAS was rebuilt, which reorders triangles
+	bool refit() {
+		return blas.refit(triangles);
+	}
+};
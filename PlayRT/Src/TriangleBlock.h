@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <bit>
+
+#include "Math.h"
+#include "Ray.h"
+#include "WideBVH.h"
+
+
+/*
+* watertight ray/triangle test (Woop, Benthin and Wald 2013):
+* the ray's largest direction axis becomes z, and a shear maps the ray onto the z axis.
+* the edge functions of the sheared vertices are then exact in sign for a shared edge,
+* so a ray through an edge or vertex of a closed mesh finds at least one of the triangles.
+* edge functions of exactly zero count as inside; there is no double precision fallback.
+*/
+struct WatertightRay {
+    WatertightRay() = default;
+    explicit WatertightRay(const Ray& ray) {
+        const vec3 absDir(std::abs(ray.direction.x), std::abs(ray.direction.y), std::abs(ray.direction.z));
+        kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+
+        sx = ray.direction[kx] / ray.direction[kz];
+        sy = ray.direction[ky] / ray.direction[kz];
+        sz = 1.0f / ray.direction[kz];
+        origin_x = ray.origin[kx];
+        origin_y = ray.origin[ky];
+        origin_z = ray.origin[kz];
+    }
+
+    uint32_t kx = 0, ky = 1, kz = 2;
+    float sx = 0.0f, sy = 0.0f, sz = 1.0f;
+    float origin_x = 0.0f, origin_y = 0.0f, origin_z = 0.0f;
+};
+
+
+/*
+* Width triangles with their vertices laid out per axis, tested against one ray at once.
+* unused slots have NaN vertices, their edge functions fail every comparison.
+*/
+template<uint32_t Width>
+struct alignas(32) TriangleBlock {
+    static_assert(Width == 4 || Width == 8, "triangle blocks are 4 or 8 wide");
+
+    float v0[3][Width], v1[3][Width], v2[3][Width];
+    uint32_t primIndex[Width];
+
+    TriangleBlock() {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        for (uint32_t i = 0; i < Width; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                v0[axis][i] = v1[axis][i] = v2[axis][i] = nan;
+            }
+            primIndex[i] = 0;
+        }
+    }
+
+    void set(uint32_t slot, const vec3& a, const vec3& b, const vec3& c, uint32_t index) {
+        for (int axis = 0; axis < 3; ++axis) {
+            v0[axis][slot] = a[axis];
+            v1[axis][slot] = b[axis];
+            v2[axis][slot] = c[axis];
+        }
+        primIndex[slot] = index;
+    }
+};
+
+
+/*
+* slots [offset, offset + 4) of a block; writes the hit distances and returns a bit per triangle hit in (0, t_max).
+*/
+template<uint32_t Width>
+inline uint32_t intersectTriangles4(const TriangleBlock<Width>& block, uint32_t offset, const WatertightRay& ray, float t_max, float* t_hit)
+{
+#ifdef PLAYRT_SSE
+    const __m128 ox = _mm_set1_ps(ray.origin_x), oy = _mm_set1_ps(ray.origin_y), oz = _mm_set1_ps(ray.origin_z);
+    const __m128 sx = _mm_set1_ps(ray.sx), sy = _mm_set1_ps(ray.sy), sz = _mm_set1_ps(ray.sz);
+
+    //vertices relative to the origin, sheared
+    auto shear = [&](const float (*v)[Width], __m128& x, __m128& y, __m128& z) {
+        const __m128 vz = _mm_sub_ps(_mm_load_ps(v[ray.kz] + offset), oz);
+        x = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(v[ray.kx] + offset), ox), _mm_mul_ps(sx, vz));
+        y = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(v[ray.ky] + offset), oy), _mm_mul_ps(sy, vz));
+        z = _mm_mul_ps(sz, vz);
+    };
+    __m128 ax, ay, az, bx, by, bz, cx, cy, cz;
+    shear(block.v0, ax, ay, az);
+    shear(block.v1, bx, by, bz);
+    shear(block.v2, cx, cy, cz);
+
+    const __m128 u = _mm_sub_ps(_mm_mul_ps(cx, by), _mm_mul_ps(cy, bx));
+    const __m128 v = _mm_sub_ps(_mm_mul_ps(ax, cy), _mm_mul_ps(ay, cx));
+    const __m128 w = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 bNonNegative = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)), _mm_cmpge_ps(w, zero));
+    const __m128 bNonPositive = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(u, zero), _mm_cmple_ps(v, zero)), _mm_cmple_ps(w, zero));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(u, v), w);
+    const __m128 t = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(u, az), _mm_mul_ps(v, bz)), _mm_mul_ps(w, cz)), det);
+
+    const __m128 hit = _mm_and_ps(
+        _mm_and_ps(_mm_or_ps(bNonNegative, bNonPositive), _mm_cmpneq_ps(det, zero)),
+        _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(t_max))));
+
+    _mm_storeu_ps(t_hit, t);
+    return static_cast<uint32_t>(_mm_movemask_ps(hit));
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+        const uint32_t slot = offset + i;
+        auto shear = [&](const float (*v)[Width], float& x, float& y, float& z) {
+            const float vz = v[ray.kz][slot] - ray.origin_z;
+            x = (v[ray.kx][slot] - ray.origin_x) - ray.sx * vz;
+            y = (v[ray.ky][slot] - ray.origin_y) - ray.sy * vz;
+            z = ray.sz * vz;
+        };
+        float ax, ay, az, bx, by, bz, cx, cy, cz;
+        shear(block.v0, ax, ay, az);
+        shear(block.v1, bx, by, bz);
+        shear(block.v2, cx, cy, cz);
+
+        const float u = cx * by - cy * bx;
+        const float v = ax * cy - ay * cx;
+        const float w = bx * ay - by * ax;
+        const float det = u + v + w;
+        const float t = (u * az + v * bz + w * cz) / det;
+
+        t_hit[i] = t;
+        const bool bInside = (u >= 0 && v >= 0 && w >= 0) || (u <= 0 && v <= 0 && w <= 0);
+        if (bInside && det != 0 && t > 0 && t < t_max) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+inline uint32_t intersectTriangles(const TriangleBlock<4>& block, const WatertightRay& ray, float t_max, float* t_hit)
+{
+    return intersectTriangles4(block, 0, ray, t_max, t_hit);
+}
+
+inline uint32_t intersectTriangles(const TriangleBlock<8>& block, const WatertightRay& ray, float t_max, float* t_hit)
+{
+#ifdef __AVX__
+    const __m256 ox = _mm256_set1_ps(ray.origin_x), oy = _mm256_set1_ps(ray.origin_y), oz = _mm256_set1_ps(ray.origin_z);
+    const __m256 sx = _mm256_set1_ps(ray.sx), sy = _mm256_set1_ps(ray.sy), sz = _mm256_set1_ps(ray.sz);
+
+    auto shear = [&](const float (*v)[8], __m256& x, __m256& y, __m256& z) {
+        const __m256 vz = _mm256_sub_ps(_mm256_load_ps(v[ray.kz]), oz);
+        x = _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v[ray.kx]), ox), _mm256_mul_ps(sx, vz));
+        y = _mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(v[ray.ky]), oy), _mm256_mul_ps(sy, vz));
+        z = _mm256_mul_ps(sz, vz);
+    };
+    __m256 ax, ay, az, bx, by, bz, cx, cy, cz;
+    shear(block.v0, ax, ay, az);
+    shear(block.v1, bx, by, bz);
+    shear(block.v2, cx, cy, cz);
+
+    const __m256 u = _mm256_sub_ps(_mm256_mul_ps(cx, by), _mm256_mul_ps(cy, bx));
+    const __m256 v = _mm256_sub_ps(_mm256_mul_ps(ax, cy), _mm256_mul_ps(ay, cx));
+    const __m256 w = _mm256_sub_ps(_mm256_mul_ps(bx, ay), _mm256_mul_ps(by, ax));
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 bNonNegative = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ)), _mm256_cmp_ps(w, zero, _CMP_GE_OQ));
+    const __m256 bNonPositive = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_LE_OQ), _mm256_cmp_ps(v, zero, _CMP_LE_OQ)), _mm256_cmp_ps(w, zero, _CMP_LE_OQ));
+
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(u, v), w);
+    const __m256 t = _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(u, az), _mm256_mul_ps(v, bz)), _mm256_mul_ps(w, cz)), det);
+
+    const __m256 hit = _mm256_and_ps(
+        _mm256_and_ps(_mm256_or_ps(bNonNegative, bNonPositive), _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+
+    _mm256_storeu_ps(t_hit, t);
+    return static_cast<uint32_t>(_mm256_movemask_ps(hit));
+#else
+    //without AVX, two SSE halves
+    return intersectTriangles4(block, 0, ray, t_max, t_hit) | (intersectTriangles4(block, 4, ray, t_max, t_hit + 4) << 4);
+#endif
+}
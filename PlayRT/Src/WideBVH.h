@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#include "Math.h"
+#include "Ray.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PLAYRT_SSE 1
+#include <immintrin.h>
+#endif
+
+
+/*
+* 4 or 8 children per node, their bounds laid out per axis so one ray is tested against all of them at once.
+* a child with count == 0 is a wide node at index child, otherwise a leaf over primitives [child, child + count);
+* unused slots have NaN bounds: every comparison in the slab test fails for them, so they never hit.
+*/
+template<uint32_t Width>
+struct alignas(32) BVHWideNode {
+    static_assert(Width == 4 || Width == 8, "wide nodes are 4 or 8 wide");
+
+    float min_x[Width], min_y[Width], min_z[Width];
+    float max_x[Width], max_y[Width], max_z[Width];
+    uint32_t child[Width];
+    uint32_t count[Width];
+
+    BVHWideNode() {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        for (uint32_t i = 0; i < Width; ++i) {
+            min_x[i] = min_y[i] = min_z[i] = nan;
+            max_x[i] = max_y[i] = max_z[i] = nan;
+            child[i] = 0;
+            count[i] = 0;
+        }
+    }
+};
+
+
+//the ray broadcast once per traversal instead of once per node
+struct WideRay {
+    WideRay() = default;
+    explicit WideRay(const Ray& ray) : origin(ray.origin), invertDir(ray.invertDir) {
+#ifdef PLAYRT_SSE
+        origin_x = _mm_set1_ps(ray.origin.x);
+        origin_y = _mm_set1_ps(ray.origin.y);
+        origin_z = _mm_set1_ps(ray.origin.z);
+        invDir_x = _mm_set1_ps(ray.invertDir.x);
+        invDir_y = _mm_set1_ps(ray.invertDir.y);
+        invDir_z = _mm_set1_ps(ray.invertDir.z);
+#endif
+#ifdef __AVX__
+        origin8_x = _mm256_set1_ps(ray.origin.x);
+        origin8_y = _mm256_set1_ps(ray.origin.y);
+        origin8_z = _mm256_set1_ps(ray.origin.z);
+        invDir8_x = _mm256_set1_ps(ray.invertDir.x);
+        invDir8_y = _mm256_set1_ps(ray.invertDir.y);
+        invDir8_z = _mm256_set1_ps(ray.invertDir.z);
+#endif
+    }
+
+    vec3 origin;
+    vec3 invertDir;
+
+#ifdef PLAYRT_SSE
+    __m128 origin_x, origin_y, origin_z;
+    __m128 invDir_x, invDir_y, invDir_z;
+#endif
+#ifdef __AVX__
+    __m256 origin8_x, origin8_y, origin8_z;
+    __m256 invDir8_x, invDir8_y, invDir8_z;
+#endif
+};
+
+
+/*
+* slab test of children [offset, offset + 4), same acceptance as AABB_intersectDistance;
+* writes the entry distances and returns a bit per hit child.
+*/
+template<uint32_t Width>
+inline uint32_t intersectChildren4(const BVHWideNode<Width>& node, uint32_t offset, const WideRay& ray, float t_max, float* t_enter)
+{
+#ifdef PLAYRT_SSE
+    __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x + offset), ray.origin_x), ray.invDir_x);
+    __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y + offset), ray.origin_y), ray.invDir_y);
+    __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z + offset), ray.origin_z), ray.invDir_z);
+    __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x + offset), ray.origin_x), ray.invDir_x);
+    __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y + offset), ray.origin_y), ray.invDir_y);
+    __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z + offset), ray.origin_z), ray.invDir_z);
+
+    __m128 max_enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+    __m128 min_exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+    __m128 hit = _mm_and_ps(
+        _mm_and_ps(_mm_cmpgt_ps(min_exit, _mm_setzero_ps()), _mm_cmple_ps(max_enter, _mm_add_ps(min_exit, _mm_set1_ps(EPSILON)))),
+        _mm_cmplt_ps(max_enter, _mm_set1_ps(t_max)));
+
+    _mm_storeu_ps(t_enter, max_enter);
+    return static_cast<uint32_t>(_mm_movemask_ps(hit));
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+        const uint32_t c = offset + i;
+        vec3 t0 = (vec3(node.min_x[c], node.min_y[c], node.min_z[c]) - ray.origin) * ray.invertDir;
+        vec3 t1 = (vec3(node.max_x[c], node.max_y[c], node.max_z[c]) - ray.origin) * ray.invertDir;
+        vec3 t_near = glm::min(t0, t1);
+        vec3 t_far = glm::max(t0, t1);
+        float max_enter = max3(t_near.x, t_near.y, t_near.z);
+        float min_exit = min3(t_far.x, t_far.y, t_far.z);
+
+        t_enter[i] = max_enter;
+        if (min_exit > 0 && max_enter <= min_exit + EPSILON && max_enter < t_max) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+inline uint32_t intersectChildren(const BVHWideNode<4>& node, const WideRay& ray, float t_max, float* t_enter)
+{
+    return intersectChildren4(node, 0, ray, t_max, t_enter);
+}
+
+inline uint32_t intersectChildren(const BVHWideNode<8>& node, const WideRay& ray, float t_max, float* t_enter)
+{
+#ifdef __AVX__
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_x), ray.origin8_x), ray.invDir8_x);
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_y), ray.origin8_y), ray.invDir8_y);
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_z), ray.origin8_z), ray.invDir8_z);
+    __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_x), ray.origin8_x), ray.invDir8_x);
+    __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_y), ray.origin8_y), ray.invDir8_y);
+    __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_z), ray.origin8_z), ray.invDir8_z);
+
+    __m256 max_enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_min_ps(t0z, t1z));
+    __m256 min_exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_max_ps(t0z, t1z));
+
+    __m256 hit = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(min_exit, _mm256_setzero_ps(), _CMP_GT_OQ),
+            _mm256_cmp_ps(max_enter, _mm256_add_ps(min_exit, _mm256_set1_ps(EPSILON)), _CMP_LE_OQ)),
+        _mm256_cmp_ps(max_enter, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+
+    _mm256_storeu_ps(t_enter, max_enter);
+    return static_cast<uint32_t>(_mm256_movemask_ps(hit));
+#else
+    //without AVX, two SSE halves
+    return intersectChildren4(node, 0, ray, t_max, t_enter) | (intersectChildren4(node, 4, ray, t_max, t_enter + 4) << 4);
+#endif
+}
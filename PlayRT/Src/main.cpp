@@ -4,6 +4,7 @@
 #include <fstream>
 #include <sstream>
 #include <chrono>
+#include <functional>
 
 #include "Timer.h"
 
@@ -22,10 +23,10 @@ string getTimeString()
 	return oss.str();
 }
 
-void saveToImage(const std::string& filename, const std::vector<vec3>& framebuffer) {
+void saveToImage(const std::string& filename, const std::vector<vec3>& framebuffer, uint32_t width, uint32_t height) {
 	if (std::ofstream ofs(filename, std::ios::out | std::ios::binary); ofs) {
 		std::cout << "render: " << filename << " is created" << std::endl;
-		ofs << "P6\n" << WIDTH << " " << HEIGHT << "\n255\n";
+		ofs << "P6\n" << width << " " << height << "\n255\n";
 
 		for (const auto& pixel : framebuffer) {
 			unsigned char color[3] = {
@@ -41,7 +42,186 @@ void saveToImage(const std::string& filename, const std::vector<vec3>& framebuff
 	}
 }
 
-int main() {
+
+/*
+* test scenes. image rows run down +y, so the ceiling of the box is at y = -1.
+*/
+uint32_t addMaterial(Scene& scene, const Material& material)
+{
+	scene.materials.push_back(material);
+	return static_cast<uint32_t>(scene.materials.size() - 1);
+}
+
+void addQuad(Scene& scene, const vec3& a, const vec3& b, const vec3& c, const vec3& d, uint32_t materialId)
+{
+	scene.triangles.emplace_back(Vertex{ a }, Vertex{ b }, Vertex{ c }, materialId);
+	scene.triangles.emplace_back(Vertex{ a }, Vertex{ c }, Vertex{ d }, materialId);
+}
+
+//a subdivided octahedron pushed out to the sphere, faces wound outwards
+void addSphere(Scene& scene, const vec3& center, float radius, uint32_t subdivisions, uint32_t materialId)
+{
+	std::function<void(vec3, vec3, vec3, uint32_t)> subdivide = [&](vec3 a, vec3 b, vec3 c, uint32_t level) {
+		if (level == 0) {
+			scene.triangles.emplace_back(Vertex{ center + a * radius }, Vertex{ center + b * radius }, Vertex{ center + c * radius }, materialId);
+			return;
+		}
+		vec3 ab = normalize(a + b), bc = normalize(b + c), ca = normalize(c + a);
+		subdivide(a, ab, ca, level - 1);
+		subdivide(ab, b, bc, level - 1);
+		subdivide(ca, bc, c, level - 1);
+		subdivide(ab, bc, ca, level - 1);
+	};
+
+	for (float sx : { -1.0f, 1.0f }) {
+		for (float sy : { -1.0f, 1.0f }) {
+			for (float sz : { -1.0f, 1.0f }) {
+				vec3 x{ sx, 0.0f, 0.0f }, y{ 0.0f, sy, 0.0f }, z{ 0.0f, 0.0f, sz };
+				if (sx * sy * sz > 0.0f) subdivide(x, y, z, subdivisions);
+				else subdivide(x, z, y, subdivisions);
+			}
+		}
+	}
+}
+
+//seen from the default camera, the open side of the box fills the image
+void buildCornellBox(Scene& scene)
+{
+	uint32_t white = addMaterial(scene, Material::lambertian(vec3(0.73f)));
+	uint32_t red = addMaterial(scene, Material::lambertian(vec3(0.65f, 0.05f, 0.05f)));
+	uint32_t green = addMaterial(scene, Material::lambertian(vec3(0.12f, 0.45f, 0.15f)));
+	uint32_t light = addMaterial(scene, Material::emissive(vec3(15.0f)));
+	uint32_t glass = addMaterial(scene, Material::dielectric(1.5f));
+	uint32_t gold = addMaterial(scene, Material::ggx(vec3(1.0f, 0.78f, 0.34f), 0.3f));
+
+	addQuad(scene, vec3(-1, 1, 0), vec3(1, 1, 0), vec3(1, 1, 2), vec3(-1, 1, 2), white);        //floor
+	addQuad(scene, vec3(-1, -1, 0), vec3(-1, -1, 2), vec3(1, -1, 2), vec3(1, -1, 0), white);    //ceiling
+	addQuad(scene, vec3(-1, -1, 2), vec3(-1, 1, 2), vec3(1, 1, 2), vec3(1, -1, 2), white);      //back
+	addQuad(scene, vec3(-1, -1, 0), vec3(-1, 1, 0), vec3(-1, 1, 2), vec3(-1, -1, 2), red);
+	addQuad(scene, vec3(1, -1, 0), vec3(1, -1, 2), vec3(1, 1, 2), vec3(1, 1, 0), green);
+	addQuad(scene, vec3(-0.3f, -0.998f, 0.7f), vec3(0.3f, -0.998f, 0.7f), vec3(0.3f, -0.998f, 1.3f), vec3(-0.3f, -0.998f, 1.3f), light);
+
+	addSphere(scene, vec3(-0.45f, 0.6f, 1.2f), 0.4f, 3, glass);
+	addSphere(scene, vec3(0.45f, 0.65f, 0.7f), 0.35f, 3, gold);
+}
+
+
+double rmse(const vector<vec3>& a, const vector<vec3>& b)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < a.size(); ++i) {
+		vec3 d = a[i] - b[i];
+		sum += glm::dot(d, d) / 3.0;
+	}
+	return std::sqrt(sum / a.size());
+}
+
+/*
+* --converge: the path tracer against references.
+* a white furnace first: a convex white Lambertian object under a background of 1 gives exactly 1 at every pixel.
+* then a Lambertian wall lit by a square emitter behind the camera: the emitter absorbs, so every depth sees only direct light,
+* albedo * emission * the view factor of the emitter from the point, with or without bounces after it.
+* then the Cornell box traced progressively in packets against a reference from the single-ray path with another seed;
+* the error should fall like 1 / sqrt(samples), so error * sqrt(samples) stays about flat.
+*/
+int convergeToReference()
+{
+	constexpr uint32_t size = 64;
+	constexpr uint32_t referenceSamples = 1024;
+	constexpr uint32_t maxSamples = 256;
+
+	float furnaceError = 0.0f;
+	{
+		Scene scene;
+		addSphere(scene, vec3(0.0f, 0.0f, 1.0f), 0.6f, 3, addMaterial(scene, Material::lambertian(vec3(1.0f))));
+		scene.buildBVH();
+
+		Renderer renderer(size, size);
+		renderer.background = vec3(1.0f);
+		for (uint32_t s = 0; s < 4; ++s) renderer.render(scene);
+		for (const auto& pixel : renderer.framebuffer)
+			furnaceError = std::max(furnaceError, max3(std::abs(pixel.x - 1.0f), std::abs(pixel.y - 1.0f), std::abs(pixel.z - 1.0f)));
+		cout << "furnace: max error " << furnaceError << '\n';
+	}
+
+	double litError = 0.0;
+	{
+		constexpr float albedo = 0.5f, emission = 2.0f, halfSize = 2.0f, wallZ = 1.0f, lightZ = -1.05f;
+		Scene scene;
+		addQuad(scene, vec3(-3, -3, wallZ), vec3(3, -3, wallZ), vec3(3, 3, wallZ), vec3(-3, 3, wallZ),
+			addMaterial(scene, Material::lambertian(vec3(albedo))));
+		addQuad(scene, vec3(-halfSize, -halfSize, lightZ), vec3(-halfSize, halfSize, lightZ), vec3(halfSize, halfSize, lightZ),
+			vec3(halfSize, -halfSize, lightZ), addMaterial(scene, Material::emissive(vec3(emission))));
+		scene.buildBVH();
+
+		//view factor of the rectangle from (0, 0) to (u, v) on a parallel plane at distance h, seen from the origin
+		const double h = wallZ - lightZ;
+		auto cornerFactor = [h](double u, double v) {
+			const double a = u / h, b = v / h, sa = std::sqrt(1.0 + a * a), sb = std::sqrt(1.0 + b * b);
+			return (a / sa * std::atan(b / sa) + b / sb * std::atan(a / sb)) / (2.0 * PI);
+		};
+
+		for (uint32_t depth : { 0u, 5u }) {
+			Renderer renderer(size, size);
+			renderer.background = vec3(0.0f);
+			renderer.maxDepth = depth;
+			for (uint32_t s = 0; s < 64; ++s) renderer.render(scene);
+
+			//the image mean against the exact mean over pixel centers, so the noise averages out
+			double rendered = 0.0, exact = 0.0;
+			for (uint32_t j = 0; j < size; ++j) {
+				for (uint32_t i = 0; i < size; ++i) {
+					const Ray ray = renderer.primaryRay(i + 0.5f, j + 0.5f, scene.camera);
+					const vec3 p = ray.origin + ray.direction * ((wallZ - ray.origin.z) / ray.direction.z);
+					const double x0 = -halfSize - p.x, x1 = halfSize - p.x, y0 = -halfSize - p.y, y1 = halfSize - p.y;
+					exact += albedo * emission * (cornerFactor(x1, y1) - cornerFactor(x0, y1) - cornerFactor(x1, y0) + cornerFactor(x0, y0));
+					rendered += renderer.framebuffer[j * size + i].x;
+				}
+			}
+			const double error = std::abs(rendered - exact) / exact;
+			litError = std::max(litError, error);
+			cout << "lit wall, max depth " << depth << ": mean " << rendered / (size * size) << " exact " << exact / (size * size)
+				<< " relative error " << error << '\n';
+		}
+	}
+
+	Scene scene;
+	buildCornellBox(scene);
+	scene.buildBVH();
+
+	Renderer reference(size, size);
+	reference.seed = 1;
+	{
+		Timer timer;
+		for (uint32_t s = 0; s < referenceSamples; ++s) reference.render(scene);
+		cout << "reference, " << referenceSamples << " spp: ";
+	}
+
+	Renderer renderer(size, size);
+	renderer.bPacketTracing = true;
+	double firstError = 0.0, lastError = 0.0;
+	for (uint32_t spp = 1; spp <= maxSamples; spp *= 2) {
+		while (renderer.getSampleCount() < spp) renderer.render(scene);
+
+		double error = rmse(renderer.framebuffer, reference.framebuffer);
+		if (spp == 1) firstError = error;
+		lastError = error * std::sqrt(double(spp));
+		cout << "spp " << spp << " rmse " << error << " rmse*sqrt(spp) " << lastError
+			<< " samples/s " << renderer.totalStats.samplesPerSecond() << " rays/s " << renderer.totalStats.raysPerSecond() << '\n';
+	}
+
+	saveToImage("converge_" + getTimeString() + ".ppm", renderer.framebuffer, renderer.getWidth(), renderer.getHeight());
+
+	//the reference's own noise is a few percent of the test's at the last step
+	bool bPassed = furnaceError < 1e-3f && litError < 0.01 && lastError < 1.5 * firstError;
+	cout << (bPassed ? "converged" : "did not converge") << '\n';
+	return bPassed ? 0 : 1;
+}
+
+
+int main(int argc, char** argv) {
+
+	if (argc > 1 && string(argv[1]) == "--converge") return convergeToReference();
 
 	//test:
 	vector<Triangle> triangles{};
@@ -109,14 +289,15 @@ int main() {
 			cout << "build bvh: ";
 		} 
 
-		Renderer renderer;
+		Renderer renderer(1920, 1080);
 		{
 			Timer timer;
 			renderer.render(scene);  
 			cout << "render: ";
 		} 
+		cout << "samples/s: " << renderer.frameStats.samplesPerSecond() << " rays/s: " << renderer.frameStats.raysPerSecond() << '\n';
 		 
-		saveToImage("output_" + getTimeString() + ".ppm", renderer.framebuffer);
+		saveToImage("output_" + getTimeString() + ".ppm", renderer.framebuffer, renderer.getWidth(), renderer.getHeight());
 	}
 
 